@@ -21,6 +21,9 @@ class Corpus {
 // typedef std::unordered_map<unsigned,std::string, std::hash<std::string> > ReverseMap;
 public: 
    bool USE_SPELLING=false; 
+   // once frozen, loading more data never adds words or POS tags: unseen
+   // ones become UNK (and POS id 0), with their surface form kept aside
+   bool frozen=false;
 
    std::map<int,std::vector<unsigned>> correct_act_sent;
    std::map<int,std::vector<unsigned>> sentences;
@@ -30,6 +33,7 @@ public:
    std::map<int,std::vector<unsigned>> sentencesDev;
    std::map<int,std::vector<unsigned>> sentencesPosDev;
    std::map<int,std::vector<std::string>> sentencesStrDev;
+   std::map<int,std::vector<std::string>> sentencesPosStrDev;  // only for unseen tags when frozen
    unsigned nsentencesDev;
 
    unsigned nsentences;
@@ -272,6 +276,7 @@ inline void load_correct_actionsDev(std::string file) {
   std::vector<unsigned> current_sent;
   std::vector<unsigned> current_sent_pos;
   std::vector<std::string> current_sent_str;
+  std::vector<std::string> current_sent_pos_str;
   while (getline(actionsFile, lineS)) {
     ReplaceStringInPlace(lineS, "-RRB-", "_RRB_");
     ReplaceStringInPlace(lineS, "-LRB-", "_LRB_");
@@ -282,6 +287,7 @@ inline void load_correct_actionsDev(std::string file) {
         sentencesDev[sentence] = current_sent;
         sentencesPosDev[sentence] = current_sent_pos;
         sentencesStrDev[sentence] = current_sent_str;
+        sentencesPosStrDev[sentence] = current_sent_pos_str;
       }
       
       sentence++;
@@ -291,6 +297,7 @@ inline void load_correct_actionsDev(std::string file) {
       current_sent.clear();
       current_sent_pos.clear();
       current_sent_str.clear();
+      current_sent_pos_str.clear();
     } else if (count == 0) {
       first = false;
       //stack and buffer, for now, leave it like this.
@@ -316,18 +323,27 @@ inline void load_correct_actionsDev(std::string file) {
           std::string pos = word.substr(posIndex + 1);
           word = word.substr(0, posIndex);
           // new POS tag
-          if (posToInt[pos] == 0) {
-            posToInt[pos] = maxPos;
-            intToPos[maxPos] = pos;
-            npos = maxPos;
-            maxPos++;
+          auto posIt = posToInt.find(pos);
+          current_sent_pos_str.push_back("");
+          if (posIt == posToInt.end() && frozen) {
+            current_sent_pos_str.back() = pos;
+            current_sent_pos.push_back(0);
+          } else {
+            if (posIt == posToInt.end()) {
+              posToInt[pos] = maxPos;
+              intToPos[maxPos] = pos;
+              npos = maxPos;
+              maxPos++;
+            }
+            current_sent_pos.push_back(posToInt[pos]);
           }
           // add an empty string for any token except OOVs (it is easy to 
           // recover the surface form of non-OOV using intToWords(id)).
           current_sent_str.push_back("");
           // OOV word
-          if (wordsToInt[word] == 0) {
-            if (USE_SPELLING) {
+          auto wordIt = wordsToInt.find(word);
+          if (wordIt == wordsToInt.end() || wordIt->second == 0) {
+            if (USE_SPELLING && !frozen) {
               max = nwords + 1;
               //std::cerr<< "max:" << max << "\n";
               wordsToInt[word] = max;
@@ -339,8 +355,7 @@ inline void load_correct_actionsDev(std::string file) {
               word = Corpus::UNK;
             }
           }
-          current_sent.push_back(wordsToInt[word]);
-          current_sent_pos.push_back(posToInt[pos]);
+          current_sent.push_back(wordsToInt.find(word)->second);
         } while(iss);
       }
       initial = false;
@@ -363,6 +378,7 @@ inline void load_correct_actionsDev(std::string file) {
     sentencesDev[sentence] = current_sent;
     sentencesPosDev[sentence] = current_sent_pos;
     sentencesStrDev[sentence] = current_sent_str;
+    sentencesPosStrDev[sentence] = current_sent_pos_str;
     sentence++;
     nsentencesDev = sentence;
   }
@@ -370,7 +386,64 @@ inline void load_correct_actionsDev(std::string file) {
   actionsFile.close();
 }
 
-void ReplaceStringInPlace(std::string& subject, const std::string& search,
+// One sentence read by read_sentence. The surface forms are only kept for
+// words and tags outside the vocabulary ("" for the others). Oracle actions
+// that were not seen in training are counted in unknown_actions and left out
+// of actions, which is then not a complete oracle.
+struct OracleSentence {
+  std::vector<unsigned> words, pos, actions;
+  std::vector<std::string> words_str, pos_str;
+  unsigned unknown_actions = 0;
+};
+
+// Reads the next sentence of a stream in the format of load_correct_actionsDev
+// (the actions are those of the oracle, if any), without ever changing the
+// vocabulary: unseen words become UNK and unseen tags 0, as when frozen, so
+// any number of threads can read at once. Returns false at the end.
+bool read_sentence(std::istream& in, OracleSentence* s) const {
+  *s = OracleSentence();
+  const unsigned unk = wordsToInt.find(Corpus::UNK)->second;
+  std::string lineS;
+  bool started = false;
+  int count = 0;
+  while (getline(in, lineS)) {
+    ReplaceStringInPlace(lineS, "-RRB-", "_RRB_");
+    ReplaceStringInPlace(lineS, "-LRB-", "_LRB_");
+    if (lineS.empty()) {
+      if (started) return true;
+    } else if (!started) {
+      if (lineS.size() < 4) continue;
+      started = true;
+      count = 1;
+      std::istringstream iss(lineS.substr(3, lineS.size() - 4));
+      std::string word;
+      while (iss >> word) {
+        if (word[word.size() - 1] == ',') word = word.substr(0, word.size() - 1);
+        size_t posIndex = word.rfind('-');
+        if (posIndex == std::string::npos) posIndex = word.size();
+        const std::string pos = posIndex < word.size() ? word.substr(posIndex + 1) : "";
+        word = word.substr(0, posIndex);
+        auto posIt = posToInt.find(pos);
+        s->pos.push_back(posIt == posToInt.end() ? 0 : posIt->second);
+        s->pos_str.push_back(posIt == posToInt.end() ? pos : "");
+        auto wordIt = wordsToInt.find(word);
+        const bool oov = wordIt == wordsToInt.end() || wordIt->second == 0;
+        s->words.push_back(oov ? unk : wordIt->second);
+        s->words_str.push_back(oov ? word : "");
+      }
+    } else if (count == 1) {
+      auto actionIter = std::find(actions.begin(), actions.end(), lineS);
+      if (actionIter != actions.end()) s->actions.push_back(std::distance(actions.begin(), actionIter));
+      else ++s->unknown_actions;
+      count = 0;
+    } else {
+      count = 1;
+    }
+  }
+  return started;
+}
+
+static void ReplaceStringInPlace(std::string& subject, const std::string& search,
                           const std::string& replace) {
     size_t pos = 0;
     while ((pos = subject.find(search, pos)) != std::string::npos) {
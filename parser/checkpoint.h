@@ -0,0 +1,97 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/version.hpp>
+
+#include "cnn/cnn.h"
+#include "cnn/training.h"
+
+// Everything the training loop needs to continue exactly where it stopped:
+// a checkpoint is this state followed by the model, in one boost text
+// archive. The random number generator is saved as well, so a resumed run
+// shuffles and replaces singletons the same way the interrupted one would
+// have.
+struct TrainingState {
+  std::string params_fname;  // where the best model on dev is written
+  float eta0 = 0, eta = 0, epoch = 0;  // trainer
+  std::vector<unsigned> order;  // shuffled training sentences
+  unsigned si = 0;  // position in order
+  unsigned iter = 0;
+  unsigned logc = 0;  // status blocks, for the dev evaluation schedule
+  bool first = true;
+  double tot_seen = 0;
+  int best_correct_heads = 0;
+  double uas = -1, prev_uas = -1;
+  std::string rng;  // state of cnn::rndeng
+  // since version 1
+  std::string optimizer = "sgd";
+  std::vector<std::vector<float>> optimizer_state;  // see SparseTrainer::save_state
+  uint64_t optimizer_steps = 0;
+  double plateau_factor = 1, best_uas = -1;  // LRSchedule
+  unsigned bad_evals = 0;
+  double train_seconds = 0;  // wall-clock time of the training so far
+  bool target_reached = false;
+  // since version 2
+  double dev_last_sentences = -1, dev_last_seconds = -1, dev_best_sample_uas = -1;  // DevSchedule
+  std::vector<double> stop_recent;  // EarlyStopping
+  double stop_best_avg = -1;
+  unsigned stop_bad_evals = 0;
+
+  void save_trainer(const cnn::Trainer& sgd) { eta0 = sgd.eta0; eta = sgd.eta; epoch = sgd.epoch; }
+  void restore_trainer(cnn::Trainer* sgd) const { sgd->eta0 = eta0; sgd->eta = eta; sgd->epoch = epoch; }
+
+  void save_rng() {
+    std::ostringstream out;
+    out << *cnn::rndeng;
+    rng = out.str();
+  }
+  void restore_rng() const {
+    std::istringstream in(rng);
+    in >> *cnn::rndeng;
+  }
+
+  template <class Archive> void serialize(Archive& ar, const unsigned int version) {
+    ar & params_fname & eta0 & eta & epoch & order & si & iter & logc & first & tot_seen
+       & best_correct_heads & uas & prev_uas & rng;
+    if (version >= 1)
+      ar & optimizer & optimizer_state & optimizer_steps & plateau_factor & best_uas & bad_evals
+         & train_seconds & target_reached;
+    if (version >= 2)
+      ar & dev_last_sentences & dev_last_seconds & dev_best_sample_uas & stop_recent & stop_best_avg & stop_bad_evals;
+  }
+};
+BOOST_CLASS_VERSION(TrainingState, 2)
+
+// writes to a temporary file first, so that a crash while writing leaves
+// the previous checkpoint intact
+inline bool save_checkpoint(const std::string& fname, const TrainingState& state, const cnn::Model& model) {
+  const std::string tmp = fname + ".tmp";
+  {
+    std::ofstream out(tmp.c_str());
+    boost::archive::text_oarchive oa(out);
+    oa << state << model;
+    if (!out) return false;
+  }
+  return std::rename(tmp.c_str(), fname.c_str()) == 0;
+}
+
+inline bool load_checkpoint(const std::string& fname, TrainingState* state, cnn::Model* model) {
+  std::ifstream in(fname.c_str());
+  if (!in) return false;
+  boost::archive::text_iarchive ia(in);
+  ia >> *state >> *model;
+  return bool(in);
+}
+
+#endif
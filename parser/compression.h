@@ -0,0 +1,114 @@
+#ifndef COMPRESSION_H_
+#define COMPRESSION_H_
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/SVD>
+
+#include "quantization.h"
+
+// Structural compression of the parser's square state and composition
+// matrices (S, B, A, H, D): either the best rank-r approximation W = U V
+// (truncated SVD), or structured pruning that drops the input columns with
+// the smallest norms. The same approximation can be written back into the
+// float model for fine-tuning and used in compact form by GreedyDecoder.
+struct CompressionSpec {
+  WeightType type = FLOAT32;  // LOWRANK or PRUNED, FLOAT32 for none
+  unsigned rank = 0;          // LOWRANK
+  float keep = 1.f;           // PRUNED: fraction of columns kept
+
+  // "lowrank:R" or "prune:F"
+  static bool parse(const std::string& s, CompressionSpec* spec) {
+    const size_t colon = s.find(':');
+    if (colon == std::string::npos) return false;
+    const std::string kind = s.substr(0, colon);
+    const std::string arg = s.substr(colon + 1);
+    if (kind == "lowrank") {
+      spec->type = LOWRANK;
+      spec->rank = std::atoi(arg.c_str());
+      return spec->rank > 0;
+    } else if (kind == "prune") {
+      spec->type = PRUNED;
+      spec->keep = std::atof(arg.c_str());
+      return spec->keep > 0.f && spec->keep <= 1.f;
+    }
+    return false;
+  }
+
+  // a comma separated list of specs
+  static bool parse_list(const std::string& s, std::vector<CompressionSpec>* specs) {
+    std::istringstream in(s);
+    std::string item;
+    while (getline(in, item, ',')) {
+      CompressionSpec spec;
+      if (!parse(item, &spec)) return false;
+      specs->push_back(spec);
+    }
+    return true;
+  }
+
+  std::string str() const {
+    std::ostringstream os;
+    if (type == LOWRANK) os << "lowrank:" << rank;
+    else if (type == PRUNED) os << "prune:" << keep;
+    else os << "none";
+    return os.str();
+  }
+};
+
+// W ~ u * v with u: rows x r and v: r x cols
+inline void low_rank_factors(const Eigen::MatrixXf& w, unsigned r, Eigen::MatrixXf* u, Eigen::MatrixXf* v) {
+  Eigen::JacobiSVD<Eigen::MatrixXf> svd(w, Eigen::ComputeThinU | Eigen::ComputeThinV);
+  r = std::min<unsigned>(r, svd.singularValues().size());
+  *u = svd.matrixU().leftCols(r) * svd.singularValues().head(r).asDiagonal();
+  *v = svd.matrixV().leftCols(r).transpose();
+}
+
+// the ceil(keep * cols) columns of w with the largest L2 norms, in order
+inline std::vector<int> columns_to_keep(const Eigen::MatrixXf& w, float keep) {
+  std::vector<int> cols(w.cols());
+  for (int c = 0; c < w.cols(); ++c) cols[c] = c;
+  const unsigned n = std::max<unsigned>(1, unsigned(keep * w.cols() + 0.999f));
+  std::sort(cols.begin(), cols.end(), [&w](int a, int b) { return w.col(a).norm() > w.col(b).norm(); });
+  cols.resize(std::min<unsigned>(n, cols.size()));
+  std::sort(cols.begin(), cols.end());
+  return cols;
+}
+
+// the dense matrix that spec approximates w with
+inline Eigen::MatrixXf approximate(const Eigen::MatrixXf& w, const CompressionSpec& spec) {
+  if (spec.type == LOWRANK) {
+    Eigen::MatrixXf u, v;
+    low_rank_factors(w, spec.rank, &u, &v);
+    return u * v;
+  } else if (spec.type == PRUNED) {
+    Eigen::MatrixXf p = Eigen::MatrixXf::Zero(w.rows(), w.cols());
+    for (int c : columns_to_keep(w, spec.keep)) p.col(c) = w.col(c);
+    return p;
+  }
+  return w;
+}
+
+// stores a float32 matrix in the compact form of spec. A low rank that would
+// not save anything leaves the matrix dense.
+inline void compress_matrix(QuantizedMatrix* m, const CompressionSpec& spec) {
+  if (m->type != FLOAT32 || m->f.size() == 0) return;
+  if (spec.type == LOWRANK && spec.rank * (m->rows + m->cols) < unsigned(m->rows * m->cols)) {
+    low_rank_factors(m->f, spec.rank, &m->u, &m->v);
+    m->f.resize(0, 0);
+    m->type = LOWRANK;
+  } else if (spec.type == PRUNED && spec.keep < 1.f) {
+    m->kept = columns_to_keep(m->f, spec.keep);
+    Eigen::MatrixXf p(m->rows, m->kept.size());
+    for (unsigned k = 0; k < m->kept.size(); ++k) p.col(k) = m->f.col(m->kept[k]);
+    m->f = p;
+    m->type = PRUNED;
+  }
+}
+
+#endif
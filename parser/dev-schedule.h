@@ -0,0 +1,126 @@
+#ifndef DEV_SCHEDULE_H_
+#define DEV_SCHEDULE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// When to evaluate on the development data during training:
+//   blocks:N     every N status blocks (of 100 updates), the first one included
+//   sentences:N  every N training sentences
+//   minutes:M    every M minutes of training
+class DevSchedule {
+ public:
+  enum Type { BLOCKS, SENTENCES, MINUTES };
+
+  static bool parse(const std::string& s, DevSchedule* schedule) {
+    std::istringstream in(s);
+    std::string name;
+    getline(in, name, ':');
+    DevSchedule r;
+    if (name == "blocks") r.type = BLOCKS;
+    else if (name == "sentences") r.type = SENTENCES;
+    else if (name == "minutes") r.type = MINUTES;
+    else return false;
+    if (!(in >> r.every) || r.every <= 0 || in.peek() != EOF) return false;
+    r.text = s;
+    *schedule = r;
+    return true;
+  }
+
+  // called after each status block, with the blocks done (logc), the
+  // training sentences seen and the seconds of training so far
+  bool due(unsigned blocks, double sentences, double seconds) const {
+    switch (type) {
+      case BLOCKS: return blocks % unsigned(every) == 1 % unsigned(every);
+      case SENTENCES: return last_sentences < 0 || sentences - last_sentences >= every;
+      case MINUTES: return last_seconds < 0 || seconds - last_seconds >= 60 * every;
+    }
+    return false;
+  }
+
+  void evaluated(double sentences, double seconds) {
+    last_sentences = sentences;
+    last_seconds = seconds;
+  }
+
+  // Whether the UAS on a dev subsample is close enough to the best one seen
+  // on it to be worth confirming on the whole development set: within one
+  // standard error of the estimate (over the tokens of the subsample).
+  bool likely_new_best(double sample_uas, unsigned long tokens) const {
+    const double se = tokens ? std::sqrt(sample_uas * (1 - sample_uas) / tokens) : 0;
+    return sample_uas + se > best_sample_uas;
+  }
+
+  void sample_score(double sample_uas) { best_sample_uas = std::max(best_sample_uas, sample_uas); }
+
+  const std::string& str() const { return text; }
+
+  // saved in checkpoints
+  double last_sentences = -1, last_seconds = -1;
+  double best_sample_uas = -1;
+
+ private:
+  Type type = BLOCKS;
+  double every = 25;
+  std::string text = "blocks:25";
+};
+
+// A fixed subsample of n development sentences with the same distribution
+// of lengths as the whole set: the sentences sorted by length are cut into n
+// strata of (nearly) equal size, and one sentence is drawn from each. The
+// seed makes it the same in every run, and after resuming.
+inline std::vector<unsigned> stratified_dev_sample(const std::vector<unsigned>& lengths, unsigned n,
+                                                   unsigned seed = 1) {
+  std::vector<unsigned> order(lengths.size());
+  std::iota(order.begin(), order.end(), 0);
+  if (n == 0 || n >= lengths.size()) return order;
+  std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return lengths[a] < lengths[b]; });
+  std::mt19937 rng(seed);
+  std::vector<unsigned> sample;
+  for (unsigned k = 0; k < n; ++k) {
+    const size_t begin = size_t(k) * order.size() / n, end = size_t(k + 1) * order.size() / n;
+    sample.push_back(order[begin + rng() % (end - begin)]);
+  }
+  std::sort(sample.begin(), sample.end());
+  return sample;
+}
+
+// Early stopping with patience: the dev UAS is averaged over a moving window
+// of the last evaluations, which smooths the noise of a subsample, and
+// training stops once that average has not improved by more than min_delta
+// for patience evaluations in a row.
+class EarlyStopping {
+ public:
+  EarlyStopping(unsigned patience, unsigned window, double min_delta) :
+      patience(patience), window(std::max(1u, window)), min_delta(std::max(0., min_delta)) {}
+
+  // adds the score of an evaluation; true when training should stop
+  bool add(double uas) {
+    recent.push_back(uas);
+    if (recent.size() > window) recent.erase(recent.begin());
+    const double avg = std::accumulate(recent.begin(), recent.end(), 0.) / recent.size();
+    if (avg > best_avg + min_delta) {
+      best_avg = avg;
+      bad_evals = 0;
+    } else {
+      ++bad_evals;
+    }
+    return stop();
+  }
+
+  bool stop() const { return patience > 0 && bad_evals >= patience; }
+
+  const unsigned patience, window;
+  const double min_delta;
+  // saved in checkpoints
+  std::vector<double> recent;
+  double best_avg = -1;
+  unsigned bad_evals = 0;
+};
+
+#endif
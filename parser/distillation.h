@@ -0,0 +1,126 @@
+#ifndef DISTILLATION_H_
+#define DISTILLATION_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "quantization.h"
+
+// The distribution of a teacher parser over the valid actions at each step
+// of the oracle transition sequence of a sentence, for training a student
+// parser on it. Only the k most likely actions of each step are kept, with
+// their log-probabilities in half precision.
+struct SoftTargets {
+  std::vector<uint32_t> offsets{0};  // the actions of step s are [offsets[s], offsets[s + 1])
+  std::vector<uint16_t> actions;
+  std::vector<uint16_t> logp;
+
+  unsigned steps() const { return offsets.size() - 1; }
+
+  // adds a step from the log_softmax over the valid actions
+  void add_step(const float* adist, const std::vector<unsigned>& valid, unsigned k) {
+    std::vector<unsigned> best(valid);
+    k = std::min<unsigned>(k, best.size());
+    std::partial_sort(best.begin(), best.begin() + k, best.end(),
+                      [&](unsigned a, unsigned b) { return adist[a] > adist[b]; });
+    for (unsigned i = 0; i < k; ++i) {
+      actions.push_back(best[i]);
+      logp.push_back(float_to_half(adist[best[i]]));
+    }
+    offsets.push_back(actions.size());
+  }
+
+  // the kept actions of a step with their probabilities at the given
+  // temperature, renormalized over the kept actions
+  void targets(unsigned step, float temperature, std::vector<std::pair<unsigned, float>>* out) const {
+    out->clear();
+    double total = 0;
+    for (unsigned i = offsets[step]; i < offsets[step + 1]; ++i) {
+      const float p = std::exp(half_to_float(logp[i]) / temperature);
+      out->push_back(std::make_pair(unsigned(actions[i]), p));
+      total += p;
+    }
+    for (auto& t : *out) t.second /= total;
+  }
+};
+
+// What log_prob_parser does for distillation: record the teacher's targets
+// along the oracle, or train on them. The loss of a step is
+//   (1 - weight) * -log p(oracle action) + weight * T^2 * sum_a q_T(a) * -log p_T(a)
+// where q_T are the teacher's targets and p_T the student's distribution,
+// both at temperature T (weight 1 ignores the oracle actions).
+struct Distillation {
+  SoftTargets* record = nullptr;  // teacher
+  unsigned topk = 8;
+  const SoftTargets* targets = nullptr;  // student
+  float weight = 1;
+  float temperature = 1;
+};
+
+// The teacher's targets for the whole training corpus, cached on disk so
+// that they are only computed once for any number of student runs. The
+// fingerprint identifies the teacher and the oracle: a cache with another
+// fingerprint is ignored.
+//
+// File format: "LSTMDST1", uint64 fingerprint, uint32 sentences, then for
+// each sentence uint32 steps, steps uint8 counts, and count (uint16 action,
+// uint16 half log-probability) pairs per step, in native byte order.
+inline bool save_soft_targets(const std::string& fname, uint64_t fingerprint, const std::vector<SoftTargets>& all) {
+  const std::string tmp = fname + ".tmp";
+  {
+    std::ofstream out(tmp.c_str(), std::ios_base::out | std::ios_base::binary);
+    auto put = [&](const void* p, size_t n) { out.write(static_cast<const char*>(p), n); };
+    const uint32_t n = all.size();
+    put("LSTMDST1", 8);
+    put(&fingerprint, sizeof(fingerprint));
+    put(&n, sizeof(n));
+    for (const SoftTargets& t : all) {
+      const uint32_t steps = t.steps();
+      put(&steps, sizeof(steps));
+      for (unsigned s = 0; s < steps; ++s) {
+        const uint8_t count = t.offsets[s + 1] - t.offsets[s];
+        put(&count, 1);
+      }
+      for (unsigned i = 0; i < t.actions.size(); ++i) {
+        put(&t.actions[i], sizeof(uint16_t));
+        put(&t.logp[i], sizeof(uint16_t));
+      }
+    }
+    if (!out) return false;
+  }
+  return std::rename(tmp.c_str(), fname.c_str()) == 0;
+}
+
+inline bool load_soft_targets(const std::string& fname, uint64_t fingerprint, std::vector<SoftTargets>* all) {
+  std::ifstream in(fname.c_str(), std::ios_base::in | std::ios_base::binary);
+  auto get = [&](void* p, size_t n) { return bool(in.read(static_cast<char*>(p), n)); };
+  char magic[8];
+  uint64_t f;
+  uint32_t n;
+  if (!get(magic, 8) || std::string(magic, 8) != "LSTMDST1" || !get(&f, sizeof(f)) || f != fingerprint ||
+      !get(&n, sizeof(n)))
+    return false;
+  all->assign(n, SoftTargets());
+  for (SoftTargets& t : *all) {
+    uint32_t steps;
+    if (!get(&steps, sizeof(steps))) return false;
+    for (unsigned s = 0; s < steps; ++s) {
+      uint8_t count;
+      if (!get(&count, 1)) return false;
+      t.offsets.push_back(t.offsets.back() + count);
+    }
+    t.actions.resize(t.offsets.back());
+    t.logp.resize(t.offsets.back());
+    for (unsigned i = 0; i < t.actions.size(); ++i)
+      if (!get(&t.actions[i], sizeof(uint16_t)) || !get(&t.logp[i], sizeof(uint16_t))) return false;
+  }
+  return true;
+}
+
+#endif
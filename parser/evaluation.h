@@ -0,0 +1,212 @@
+#ifndef EVALUATION_H_
+#define EVALUATION_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Transitions are strings such as "SHIFT", "SWAP" or "LEFT-ARC(nsubj)".
+// ActionTable decodes them once, so that turning a transition sequence into
+// a tree only looks at small integer arrays.
+class ActionTable {
+ public:
+  enum Kind { SHIFT, SWAP, LEFT, RIGHT };
+
+  explicit ActionTable(const std::vector<std::string>& actions) {
+    std::unordered_map<std::string, int> ids;
+    for (auto& a : actions) {
+      if (a[0] == 'S' && a[1] == 'H') { kinds.push_back(SHIFT); rels.push_back(-1); continue; }
+      if (a[0] == 'S' && a[1] == 'W') { kinds.push_back(SWAP); rels.push_back(-1); continue; }
+      assert(a[0] == 'L' || a[0] == 'R');
+      kinds.push_back(a[0] == 'L' ? LEFT : RIGHT);
+      const size_t open = a.find('('), close = a.rfind(')');
+      const std::string rel = open != std::string::npos && close > open ? a.substr(open + 1, close - open - 1) : a;
+      auto it = ids.find(rel);
+      if (it == ids.end()) {
+        it = ids.insert(std::make_pair(rel, int(names.size()))).first;
+        names.push_back(rel);
+      }
+      rels.push_back(it->second);
+    }
+  }
+
+  Kind kind(unsigned action) const { return kinds[action]; }
+  int rel(unsigned action) const { return rels[action]; }  // -1 for SHIFT and SWAP
+  const std::string& rel_name(int r) const { return names[r]; }
+  unsigned nrels() const { return names.size(); }
+
+ private:
+  std::vector<Kind> kinds;
+  std::vector<int> rels;
+  std::vector<std::string> names;
+};
+
+// runs a transition sequence and returns, for every position of the
+// sentence (the last one being ROOT), the position of its head and the id of
+// its relation; -1 for words that were not attached
+inline void compute_heads(unsigned sent_len, const std::vector<unsigned>& actions, const ActionTable& table,
+                          std::vector<int>* heads, std::vector<int>* rels) {
+  heads->assign(sent_len, -1);
+  rels->assign(sent_len, -1);
+  std::vector<int> bufferi(sent_len + 1, 0), stacki(1, -999);
+  for (unsigned i = 0; i < sent_len; ++i)
+    bufferi[sent_len - i] = i;
+  bufferi[0] = -999;
+  for (auto action : actions) {
+    switch (table.kind(action)) {
+      case ActionTable::SHIFT:
+        assert(bufferi.size() > 1);
+        stacki.push_back(bufferi.back());
+        bufferi.pop_back();
+        break;
+      case ActionTable::SWAP: {
+        assert(stacki.size() > 2);
+        const int top = stacki.back();
+        stacki.pop_back();
+        bufferi.push_back(stacki.back());
+        stacki.back() = top;
+        break;
+      }
+      default: {
+        assert(stacki.size() > 2);
+        const bool left = table.kind(action) == ActionTable::LEFT;
+        const int top = stacki.back();
+        stacki.pop_back();
+        const int head = left ? top : stacki.back();
+        const int dep = left ? stacki.back() : top;
+        (*heads)[dep] = head;
+        (*rels)[dep] = table.rel(action);
+        stacki.back() = head;
+      }
+    }
+  }
+  assert(bufferi.size() == 1);
+}
+
+// true for tokens made only of punctuation characters, which is how the
+// CoNLL-X eval.pl script decides what to leave out of the scores. Besides
+// ASCII, the UTF-8 general punctuation block (dashes, quotes, ellipsis)
+// and the CJK full stop and commas are recognized.
+inline bool is_punctuation(const std::string& form) {
+  if (form.empty()) return false;
+  for (size_t i = 0; i < form.size();) {
+    const unsigned char c = form[i];
+    if (c < 0x80) {
+      if (!ispunct(c)) return false;
+      ++i;
+    } else if (c == 0xe2 && i + 2 < form.size() && (unsigned char)form[i + 1] == 0x80) {
+      i += 3;  // U+2000 - U+203F
+    } else if (c == 0xe3 && i + 2 < form.size() && (unsigned char)form[i + 1] == 0x80 &&
+               (unsigned char)form[i + 2] <= 0x82) {
+      i += 3;  // U+3000 - U+3002
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Attachment scores over a set of sentences, with and without punctuation,
+// broken down by gold relation and by sentence length. Evaluations of parts
+// of a data set (e.g. one per thread) can be merged.
+class Evaluation {
+ public:
+  struct Counts {
+    unsigned long tokens = 0, heads = 0, labeled = 0;
+
+    void add(bool head, bool label) {
+      ++tokens;
+      heads += head;
+      labeled += head && label;
+    }
+    void merge(const Counts& o) {
+      tokens += o.tokens;
+      heads += o.heads;
+      labeled += o.labeled;
+    }
+    double uas() const { return tokens ? double(heads) / tokens : 0; }
+    double las() const { return tokens ? double(labeled) / tokens : 0; }
+  };
+
+  // gold and predicted trees from compute_heads; punct marks the tokens
+  // that are left out of the scores without punctuation (may be empty)
+  void add(const std::vector<int>& gold_heads, const std::vector<int>& gold_rels,
+           const std::vector<int>& heads, const std::vector<int>& rels,
+           const std::vector<bool>& punct) {
+    const unsigned len = gold_heads.size() - 1;  // without ROOT
+    Counts& by_len = by_length[std::min(len / 10, kLengthBuckets - 1)];
+    bool complete = true;
+    for (unsigned i = 0; i < len; ++i) {
+      const bool head = heads[i] == gold_heads[i];
+      const bool label = rels[i] == gold_rels[i];
+      all.add(head, label);
+      complete = complete && head;
+      if (!punct.empty() && punct[i]) continue;
+      scored.add(head, label);
+      by_len.add(head, label);
+      if (gold_rels[i] >= 0) {
+        if (by_relation.size() <= unsigned(gold_rels[i])) by_relation.resize(gold_rels[i] + 1);
+        by_relation[gold_rels[i]].add(head, label);
+      }
+    }
+    ++sentences;
+    complete_sentences += complete;
+  }
+
+  void merge(const Evaluation& o) {
+    all.merge(o.all);
+    scored.merge(o.scored);
+    for (unsigned b = 0; b < kLengthBuckets; ++b) by_length[b].merge(o.by_length[b]);
+    if (by_relation.size() < o.by_relation.size()) by_relation.resize(o.by_relation.size());
+    for (unsigned r = 0; r < o.by_relation.size(); ++r) by_relation[r].merge(o.by_relation[r]);
+    sentences += o.sentences;
+    complete_sentences += o.complete_sentences;
+  }
+
+  // all tokens, including punctuation (as reported during training)
+  double uas() const { return all.uas(); }
+  double las() const { return all.las(); }
+  // without punctuation
+  double uas_nopunct() const { return scored.uas(); }
+  double las_nopunct() const { return scored.las(); }
+  unsigned long correct_heads() const { return all.heads; }
+  unsigned long tokens() const { return all.tokens; }
+
+  void report(std::ostream& out, const ActionTable& table) const {
+    out << std::fixed << std::setprecision(4)
+        << "Without punctuation: uas: " << scored.uas() << " las: " << scored.las()
+        << " (" << scored.tokens << " of " << all.tokens << " tokens scored); complete trees: "
+        << (sentences ? double(complete_sentences) / sentences : 0) << '\n'
+        << "  by relation (tokens, uas, las):\n";
+    for (unsigned r = 0; r < by_relation.size(); ++r) {
+      if (!by_relation[r].tokens) continue;
+      out << "    " << std::left << std::setw(16) << table.rel_name(r) << std::right << std::setw(8)
+          << by_relation[r].tokens << std::setw(8) << by_relation[r].uas() << std::setw(8) << by_relation[r].las() << '\n';
+    }
+    out << "  by sentence length (tokens, uas, las):\n";
+    for (unsigned b = 0; b < kLengthBuckets; ++b) {
+      if (!by_length[b].tokens) continue;
+      out << "    " << std::setw(4) << b * 10 << '-';
+      if (b + 1 < kLengthBuckets) out << std::left << std::setw(4) << b * 10 + 9 << std::right; else out << "    ";
+      out << "        " << std::setw(8) << by_length[b].tokens << std::setw(8) << by_length[b].uas()
+          << std::setw(8) << by_length[b].las() << '\n';
+    }
+    out << std::defaultfloat;
+  }
+
+ private:
+  static const unsigned kLengthBuckets = 7;  // by tens, the last one open
+
+  Counts all, scored;
+  Counts by_length[kLengthBuckets];
+  std::vector<Counts> by_relation;  // by gold relation id
+  unsigned long sentences = 0;
+  unsigned long complete_sentences = 0;
+};
+
+#endif
@@ -0,0 +1,584 @@
+#ifndef GREEDY_DECODER_H_
+#define GREEDY_DECODER_H_
+
+#include <cassert>
+#include <cmath>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "cnn/cnn.h"
+#include "cnn/lstm.h"
+#include "compression.h"
+#include "parse-budget.h"
+#include "profile.h"
+#include "quantization.h"
+
+// Greedy decoding without a computation graph.
+//
+// log_prob_parser keeps every node it builds alive until the sentence ends
+// (rewound stack LSTM steps, log_softmax nodes, composed subtrees), so its
+// memory grows with the number of transitions. The decoder below computes
+// the same function directly from the model's weights and keeps only the
+// states that are still reachable: one LSTM state per stack and buffer
+// element, the current action LSTM state and the embeddings of the subtrees
+// currently on the stack. Its peak memory therefore scales with the live
+// parser state rather than with the length of the transition sequence.
+
+typedef Eigen::VectorXf Vec;
+typedef Eigen::MatrixXf Mat;
+
+inline Mat to_matrix(const cnn::Parameters* p) {
+  return Eigen::Map<const Mat>(p->values.v, p->values.d.rows(), p->values.d.cols());
+}
+
+// refers to the rows of a lookup table in place (an empty table for nullptr)
+inline QuantizedTable to_table(const cnn::LookupParameters* p) {
+  QuantizedTable t;
+  if (!p) return t;
+  t.rows = p->values.size();
+  t.dim = t.rows ? p->values[0].d.size() : 0;
+  for (auto& v : p->values) t.ref.push_back(v.v);
+  return t;
+}
+
+// rational approximation of tanh (the one Eigen uses for its packet math),
+// accurate to a few ulp on [-9, 9] and saturated outside. Unlike std::tanh it
+// has no branches or calls, so loops over it are vectorized by the compiler.
+inline float fast_tanh(float x) {
+  x = x < -9.f ? -9.f : (x > 9.f ? 9.f : x);
+  const float x2 = x * x;
+  float p = -2.76076847742355e-16f;
+  p = p * x2 + 2.00018790482477e-13f;
+  p = p * x2 + -8.60467152213735e-11f;
+  p = p * x2 + 5.12229709037114e-08f;
+  p = p * x2 + 1.48572235717979e-05f;
+  p = p * x2 + 6.37261928875436e-04f;
+  p = p * x2 + 4.89352455891786e-03f;
+  float q = 1.19825839466702e-06f;
+  q = q * x2 + 1.18534705686654e-04f;
+  q = q * x2 + 2.26843463243900e-03f;
+  q = q * x2 + 4.89352518554385e-03f;
+  return x * p / q;
+}
+
+inline float fast_logistic(float x) { return 0.5f * fast_tanh(0.5f * x) + 0.5f; }
+
+inline void tanh_inplace(Vec& v) {
+  float* p = v.data();
+  for (int i = 0; i < v.size(); ++i) p[i] = fast_tanh(p[i]);
+}
+
+inline void rectify_inplace(Vec& v) {
+  float* p = v.data();
+  for (int i = 0; i < v.size(); ++i) p[i] = p[i] < 0.f ? 0.f : p[i];
+}
+
+struct LSTMState {
+  std::vector<Vec> h;  // one per layer
+  std::vector<Vec> c;
+};
+
+// forward-only copy of a cnn::LSTMBuilder. cnn's LSTM has (full matrix)
+// peephole connections and couples the forget gate to the input gate
+// (f = 1 - i). The weights of the three gates are packed so that a step
+// costs one matvec for the input, one for the previous output and the two
+// peephole matvecs, instead of eight separate products.
+struct GraphlessLSTM {
+  // same order as the parameters of each layer in cnn/lstm.cc
+  enum { X2I, H2I, C2I, BI, X2O, H2O, C2O, BO, X2C, H2C, BC };
+
+  struct Layer {
+    QuantizedMatrix wx;  // [X2I; X2C; X2O]
+    QuantizedMatrix wh;  // [H2I; H2C; H2O]
+    QuantizedMatrix c2i, c2o;
+    Vec b;  // [BI; BC; BO]
+  };
+
+  typedef void (*StepFn)(const Layer&, const Vec& x, const Vec* h_tm1, const Vec* c_tm1,
+                         Vec* gates, Vec* h, Vec* c);
+
+  GraphlessLSTM() : step(nullptr) {}
+
+  explicit GraphlessLSTM(const cnn::LSTMBuilder& builder) {
+    for (auto& p : builder.params) {
+      Layer l;
+      const unsigned hidden = p[H2I]->values.d.rows();
+      Mat wx(3 * hidden, p[X2I]->values.d.cols());
+      wx << to_matrix(p[X2I]), to_matrix(p[X2C]), to_matrix(p[X2O]);
+      Mat wh(3 * hidden, hidden);
+      wh << to_matrix(p[H2I]), to_matrix(p[H2C]), to_matrix(p[H2O]);
+      l.wx = wx;
+      l.wh = wh;
+      l.c2i = to_matrix(p[C2I]);
+      l.c2o = to_matrix(p[C2O]);
+      l.b.resize(3 * hidden);
+      l.b << to_matrix(p[BI]), to_matrix(p[BC]), to_matrix(p[BO]);
+      layers.push_back(l);
+    }
+    select_step();
+  }
+
+  // fused cell update; N is the hidden dimension when it is known at compile
+  // time, which lets the compiler unroll and vectorize the gate loops.
+  template <int N>
+  static void fused_step(const Layer& l, const Vec& x, const Vec* h_tm1, const Vec* c_tm1,
+                         Vec* gates, Vec* h, Vec* c) {
+    enum { G = N == Eigen::Dynamic ? Eigen::Dynamic : 3 * N };
+    const int n = N == Eigen::Dynamic ? l.c2i.rows : N;
+    gates->resize(3 * n);
+    h->resize(n);
+    c->resize(n);
+    Eigen::Map<Eigen::Matrix<float, G, 1>> g(gates->data(), 3 * n);
+    Eigen::Map<const Eigen::Matrix<float, G, Eigen::Dynamic>> wx(l.wx.f.data(), 3 * n, l.wx.cols);
+    g = l.b;
+    g.noalias() += wx * x;
+    float* gi = gates->data();
+    float* gw = gi + n;
+    float* go = gw + n;
+    float* pc = c->data();
+    float* ph = h->data();
+    if (h_tm1) {
+      Eigen::Map<const Eigen::Matrix<float, G, N>> wh(l.wh.f.data(), 3 * n, n);
+      g.noalias() += wh * *h_tm1;
+      g.head(n).noalias() += l.c2i.f * *c_tm1;
+      const float* pc_tm1 = c_tm1->data();
+      for (int k = 0; k < n; ++k)  // (1 - i) * c_tm1 + i * w
+        pc[k] = pc_tm1[k] + fast_logistic(gi[k]) * (fast_tanh(gw[k]) - pc_tm1[k]);
+      Eigen::Map<Eigen::Matrix<float, N, 1>>(go, n).noalias() += l.c2o.f * *c;
+    } else {  // no recurrent or peephole terms at the start of a sequence
+      for (int k = 0; k < n; ++k)
+        pc[k] = fast_logistic(gi[k]) * fast_tanh(gw[k]);
+    }
+    for (int k = 0; k < n; ++k)
+      ph[k] = fast_logistic(go[k]) * fast_tanh(pc[k]);
+  }
+
+  // the same update with quantized weights
+  static void quantized_step(const Layer& l, const Vec& x, const Vec* h_tm1, const Vec* c_tm1,
+                             Vec* gates, Vec* h, Vec* c) {
+    const int n = l.c2i.rows;
+    *gates = l.b;
+    h->resize(n);
+    c->resize(n);
+    l.wx.gemv(x.data(), gates->data());
+    float* gi = gates->data();
+    float* gw = gi + n;
+    float* go = gw + n;
+    float* pc = c->data();
+    float* ph = h->data();
+    if (h_tm1) {
+      l.wh.gemv(h_tm1->data(), gates->data());
+      l.c2i.gemv(c_tm1->data(), gi);
+      const float* pc_tm1 = c_tm1->data();
+      for (int k = 0; k < n; ++k)
+        pc[k] = pc_tm1[k] + fast_logistic(gi[k]) * (fast_tanh(gw[k]) - pc_tm1[k]);
+      l.c2o.gemv(pc, go);
+    } else {
+      for (int k = 0; k < n; ++k)
+        pc[k] = fast_logistic(gi[k]) * fast_tanh(gw[k]);
+    }
+    for (int k = 0; k < n; ++k)
+      ph[k] = fast_logistic(go[k]) * fast_tanh(pc[k]);
+  }
+
+  // picks a kernel specialized for the hidden sizes we deploy, a generic one
+  // otherwise, or the quantized one
+  void select_step() {
+    if (layers.empty()) return;
+    if (layers[0].wx.type != FLOAT32) {
+      step = &quantized_step;
+      return;
+    }
+    switch (layers[0].c2i.rows) {
+      case 100: step = &fused_step<100>; break;
+      case 200: step = &fused_step<200>; break;
+      case 400: step = &fused_step<400>; break;
+      default: step = &fused_step<Eigen::Dynamic>;
+    }
+  }
+
+  void quantize(WeightType t) {
+    for (auto& l : layers) {
+      l.wx.quantize(t);
+      l.wh.quantize(t);
+      l.c2i.quantize(t);
+      l.c2o.quantize(t);
+    }
+    select_step();
+  }
+
+  size_t bytes() const {
+    size_t b = 0;
+    for (auto& l : layers)
+      b += l.wx.bytes() + l.wh.bytes() + l.c2i.bytes() + l.c2o.bytes() + l.b.size() * sizeof(float);
+    return b;
+  }
+
+  void write(std::ostream& out) const {
+    const uint32_t n = layers.size();
+    out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    for (auto& l : layers) {
+      l.wx.write(out);
+      l.wh.write(out);
+      l.c2i.write(out);
+      l.c2o.write(out);
+      write_matrix(out, l.b);
+    }
+  }
+
+  void read(std::istream& in) {
+    uint32_t n = 0;
+    in.read(reinterpret_cast<char*>(&n), sizeof(n));
+    layers.resize(n);
+    for (auto& l : layers) {
+      l.wx.read(in);
+      l.wh.read(in);
+      l.c2i.read(in);
+      l.c2o.read(in);
+      read_matrix(in, &l.b);
+    }
+    select_step();
+  }
+
+  // computes the state reached by reading x after prev (nullptr at the
+  // beginning of a sequence, where cnn uses no recurrent terms at all).
+  void add_input(const LSTMState* prev, const Vec& x, LSTMState* next) const {
+    static thread_local Vec gates;
+    next->h.resize(layers.size());
+    next->c.resize(layers.size());
+    const Vec* in = &x;
+    for (unsigned i = 0; i < layers.size(); ++i) {
+      step(layers[i], *in, prev ? &prev->h[i] : nullptr, prev ? &prev->c[i] : nullptr,
+           &gates, &next->h[i], &next->c[i]);
+      in = &next->h[i];
+    }
+  }
+
+  std::vector<Layer> layers;
+  StepFn step;
+};
+
+// A stack whose popped elements keep their storage, so that pushing onto it
+// again assigns into vectors of the right size instead of allocating.
+template <class T>
+struct ReusableStack {
+  T& push() {
+    if (n == items.size()) items.emplace_back();
+    return items[n++];
+  }
+  void pop() { --n; }
+  void resize(unsigned k) {
+    if (k > items.size()) items.resize(k);
+    n = k;
+  }
+  unsigned size() const { return n; }
+  T& back() { return items[n - 1]; }
+  T& operator[](unsigned i) { return items[i]; }
+
+ private:
+  std::vector<T> items;
+  unsigned n = 0;
+};
+
+// scratch state of GreedyDecoder::parse, reused by the sentences parsed on
+// a thread so that only the returned actions are allocated per sentence
+struct DecoderWorkspace {
+  ReusableStack<Vec> buffer, stack;
+  std::vector<int> bufferi, stacki;
+  ReusableStack<LSTMState> buffer_states, stack_states;
+  LSTMState action_state, next_action_state;
+  std::vector<unsigned> current_valid_actions;
+  Vec e, p_t, r_t, composed, tokj;
+};
+
+struct DecodeStats {
+  unsigned transitions = 0;
+  unsigned peak_live_states = 0;  // LSTM states held at the same time
+  bool degraded = false;  // the budget ran out and the parse was completed by rule
+};
+
+// first bytes of a file written by GreedyDecoder::write
+const char kDecoderMagic[] = "LSTMPDE2";
+
+struct GreedyDecoder {
+  typedef bool (*ForbiddenFn)(const std::string&, unsigned, unsigned, const std::vector<int>&);
+
+  // copies the dense weights of a ParserBuilder; lookup tables are read in
+  // place, so the builder's model must outlive the decoder.
+  template <class Builder>
+  GreedyDecoder(const Builder& b, const std::unordered_map<unsigned, std::vector<float>>& pretrained) :
+      stack_lstm(b.stack_lstm), buffer_lstm(b.buffer_lstm), action_lstm(b.action_lstm),
+      w_table(to_table(b.p_w)), t_table(to_table(b.p_t)), a_table(to_table(b.p_a)),
+      r_table(to_table(b.p_r)), p_table(to_table(b.p_p)),
+      pbias(to_matrix(b.p_pbias)), A(to_matrix(b.p_A)), B(to_matrix(b.p_B)), S(to_matrix(b.p_S)),
+      H(to_matrix(b.p_H)), D(to_matrix(b.p_D)), R(to_matrix(b.p_R)),
+      w2l(to_matrix(b.p_w2l)), ib(to_matrix(b.p_ib)), cbias(to_matrix(b.p_cbias)),
+      p2a(to_matrix(b.p_p2a)), action_start(to_matrix(b.p_action_start)), abias(to_matrix(b.p_abias)),
+      buffer_guard(to_matrix(b.p_buffer_guard)), stack_guard(to_matrix(b.p_stack_guard)),
+      pretrained(&pretrained), forbidden(&Builder::IsActionForbidden) {
+    if (b.p_p) p2l = to_matrix(b.p_p2l);
+    if (b.p_t) t2l = to_matrix(b.p_t2l);
+  }
+
+  // reads a decoder saved with write(), which needs no cnn model at all
+  GreedyDecoder(std::istream& in, const std::unordered_map<unsigned, std::vector<float>>& pretrained,
+                ForbiddenFn forbidden) : pretrained(&pretrained), forbidden(forbidden) {
+    std::string magic(sizeof(kDecoderMagic) - 1, '\0');
+    in.read(&magic[0], magic.size());
+    if (!in || magic != kDecoderMagic) {
+      in.setstate(std::ios::failbit);
+      return;
+    }
+    stack_lstm.read(in);
+    buffer_lstm.read(in);
+    action_lstm.read(in);
+    for (QuantizedTable* t : tables()) t->read(in);
+    for (Vec* v : vectors()) read_matrix(in, v);
+    for (QuantizedMatrix* m : matrices()) m->read(in);
+  }
+
+  void write(std::ostream& out) const {
+    out.write(kDecoderMagic, sizeof(kDecoderMagic) - 1);
+    stack_lstm.write(out);
+    buffer_lstm.write(out);
+    action_lstm.write(out);
+    GreedyDecoder& self = const_cast<GreedyDecoder&>(*this);
+    for (QuantizedTable* t : self.tables()) t->write(out);
+    for (Vec* v : self.vectors()) write_matrix(out, *v);
+    for (QuantizedMatrix* m : self.matrices()) m->write(out);
+  }
+
+  // converts every matrix and embedding table to t
+  void quantize(WeightType t) {
+    stack_lstm.quantize(t);
+    buffer_lstm.quantize(t);
+    action_lstm.quantize(t);
+    for (QuantizedTable* table : tables()) table->quantize(t);
+    for (QuantizedMatrix* m : matrices()) m->quantize(t);
+  }
+
+  // makes the decoder independent of the cnn model: float32 tables that
+  // point into it get their own copy of the rows (see QuantizedTable::own)
+  void own_tables() {
+    for (QuantizedTable* t : tables()) t->own();
+  }
+
+  // stores the state and composition matrices in compact form
+  void compress(const CompressionSpec& spec) {
+    for (QuantizedMatrix* m : {&S, &B, &A, &H, &D}) compress_matrix(m, spec);
+  }
+
+  // memory held by the weights (float32 tables that point into a cnn model
+  // are not counted)
+  size_t bytes() const {
+    GreedyDecoder& self = const_cast<GreedyDecoder&>(*this);
+    size_t b = stack_lstm.bytes() + buffer_lstm.bytes() + action_lstm.bytes();
+    for (QuantizedTable* t : self.tables()) b += t->bytes();
+    for (Vec* v : self.vectors()) b += v->size() * sizeof(float);
+    for (QuantizedMatrix* m : self.matrices()) b += m->bytes();
+    return b;
+  }
+
+  // same contract as ParserBuilder::log_prob_parser without reference actions
+  std::vector<unsigned> parse(const std::vector<unsigned>& raw_sent,
+                              const std::vector<unsigned>& sent,
+                              const std::vector<unsigned>& sentPos,
+                              const std::vector<std::string>& setOfActions,
+                              const std::vector<unsigned>& possible_actions,
+                              const ParseBudget* budget = nullptr,
+                              DecodeStats* stats = nullptr) const {
+    BudgetClock clock(budget);
+    ++degradation_counters.sentences;
+    PROFILE_TIMER(timer);
+    bool degraded = false;
+    std::vector<unsigned> results;
+    results.reserve(2 * sent.size());  // enough unless the parse swaps
+    static thread_local DecoderWorkspace ws;
+    LSTMState& action_state = ws.action_state;
+    LSTMState& next_action_state = ws.next_action_state;
+    action_lstm.add_input(nullptr, action_start, &action_state);
+    Vec& e = ws.e;  // embedding rows
+
+    // element k of each of these is the LSTM state after reading element k
+    // of the buffer (resp. stack); popping an element rewinds the LSTM.
+    ReusableStack<Vec>& buffer = ws.buffer;
+    std::vector<int>& bufferi = ws.bufferi;
+    buffer.resize(sent.size() + 1);
+    bufferi.resize(sent.size() + 1);
+    for (unsigned i = 0; i < sent.size(); ++i) {
+      Vec& x = buffer[sent.size() - i];
+      x = ib;
+      e.resize(w_table.dim);
+      w_table.row(sent[i], e.data());
+      w2l.gemv(e.data(), x.data());
+      if (!p_table.empty()) {
+        e.resize(p_table.dim);
+        p_table.row(sentPos[i], e.data());
+        p2l.gemv(e.data(), x.data());
+      }
+      if (!t_table.empty() && pretrained->count(raw_sent[i])) {
+        e.resize(t_table.dim);
+        t_table.row(raw_sent[i], e.data());
+        t2l.gemv(e.data(), x.data());
+      }
+      rectify_inplace(x);
+      bufferi[sent.size() - i] = i;
+    }
+    buffer[0] = buffer_guard;
+    bufferi[0] = -999;
+    ReusableStack<LSTMState>& buffer_states = ws.buffer_states;
+    buffer_states.resize(buffer.size());
+    for (unsigned k = 0; k < buffer.size(); ++k)
+      buffer_lstm.add_input(k ? &buffer_states[k - 1] : nullptr, buffer[k], &buffer_states[k]);
+
+    ReusableStack<Vec>& stack = ws.stack;
+    std::vector<int>& stacki = ws.stacki;
+    ReusableStack<LSTMState>& stack_states = ws.stack_states;
+    stack.resize(0);
+    stacki.clear();
+    stack_states.resize(0);
+    stack.push() = stack_guard;
+    stacki.push_back(-999);
+    stack_lstm.add_input(nullptr, stack.back(), &stack_states.push());
+    PROFILE_LAP(timer, PROFILE_BUFFER);
+
+    unsigned peak = 0;
+    std::vector<unsigned>& current_valid_actions = ws.current_valid_actions;
+    while (stack.size() > 2 || buffer.size() > 1) {
+      if (clock.exhausted(results.size())) {
+        complete_parse(*budget, setOfActions, forbidden, stacki, bufferi, &results);
+        degraded = true;
+        break;
+      }
+      peak = std::max<unsigned>(peak, stack_states.size() + buffer_states.size() + 1);
+      current_valid_actions.clear();
+      for (auto a : possible_actions) {
+        if (forbidden(setOfActions[a], buffer.size(), stack.size(), stacki))
+          continue;
+        current_valid_actions.push_back(a);
+      }
+      PROFILE_LAP(timer, PROFILE_VALID_ACTIONS);
+
+      Vec& p_t = ws.p_t;
+      p_t = pbias;
+      S.gemv(stack_states.back().h.back().data(), p_t.data());
+      B.gemv(buffer_states.back().h.back().data(), p_t.data());
+      A.gemv(action_state.h.back().data(), p_t.data());
+      rectify_inplace(p_t);
+      Vec& r_t = ws.r_t;
+      r_t = abias;
+      p2a.gemv(p_t.data(), r_t.data());
+      // log_softmax is monotonic, so the best action can be read off r_t
+      unsigned action = current_valid_actions[0];
+      for (unsigned i = 1; i < current_valid_actions.size(); ++i)
+        if (r_t[current_valid_actions[i]] > r_t[action])
+          action = current_valid_actions[i];
+      results.push_back(action);
+      PROFILE_LAP(timer, PROFILE_SCORE);
+
+      e.resize(a_table.dim);
+      a_table.row(action, e.data());
+      action_lstm.add_input(&action_state, e, &next_action_state);
+      std::swap(action_state, next_action_state);
+      PROFILE_LAP(timer, PROFILE_LSTM);
+
+      const std::string& actionString = setOfActions[action];
+      const char ac = actionString[0];
+      const char ac2 = actionString[1];
+      if (ac == 'S' && ac2 == 'H') {  // SHIFT
+        assert(buffer.size() > 1);
+        stack.push() = buffer.back();
+        stacki.push_back(bufferi.back());
+        LSTMState& next = stack_states.push();
+        stack_lstm.add_input(&stack_states[stack_states.size() - 2], stack.back(), &next);
+        buffer.pop();
+        bufferi.pop_back();
+        buffer_states.pop();
+      } else if (ac == 'S' && ac2 == 'W') {  // SWAP
+        assert(stack.size() > 2);
+        Vec& tokj = ws.tokj;
+        tokj = stack.back();
+        int jj = stacki.back();
+        stack.pop(); stacki.pop_back(); stack_states.pop();
+        buffer.push() = stack.back();
+        bufferi.push_back(stacki.back());
+        stack.pop(); stacki.pop_back(); stack_states.pop();
+        LSTMState& next_buffer = buffer_states.push();
+        buffer_lstm.add_input(&buffer_states[buffer_states.size() - 2], buffer.back(), &next_buffer);
+        stack.push() = tokj;
+        stacki.push_back(jj);
+        LSTMState& next_stack = stack_states.push();
+        stack_lstm.add_input(&stack_states[stack_states.size() - 2], stack.back(), &next_stack);
+      } else {  // LEFT or RIGHT
+        assert(stack.size() > 2);
+        assert(ac == 'L' || ac == 'R');
+        const unsigned top = stack.size() - 1;
+        const Vec& head = stack[ac == 'R' ? top - 1 : top];
+        const Vec& dep = stack[ac == 'R' ? top : top - 1];
+        const int headi = stacki[ac == 'R' ? top - 1 : top];
+        Vec& composed = ws.composed;
+        composed = cbias;
+        H.gemv(head.data(), composed.data());
+        D.gemv(dep.data(), composed.data());
+        e.resize(r_table.dim);
+        r_table.row(action, e.data());
+        R.gemv(e.data(), composed.data());
+        tanh_inplace(composed);
+        PROFILE_LAP(timer, PROFILE_COMPOSE);
+        stack.resize(top - 1); stacki.resize(top - 1); stack_states.resize(top - 1);
+        stack.push() = composed;
+        stacki.push_back(headi);
+        LSTMState& next = stack_states.push();
+        stack_lstm.add_input(&stack_states[stack_states.size() - 2], stack.back(), &next);
+      }
+      PROFILE_LAP(timer, PROFILE_LSTM);
+    }
+    assert(degraded || stack.size() == 2);
+    assert(degraded || buffer.size() == 1);
+    if (stats) {
+      stats->transitions = results.size();
+      stats->peak_live_states = peak;
+      stats->degraded = degraded;
+    }
+    return results;
+  }
+
+  GraphlessLSTM stack_lstm;
+  GraphlessLSTM buffer_lstm;
+  GraphlessLSTM action_lstm;
+  QuantizedTable w_table;  // word embeddings
+  QuantizedTable t_table;  // pretrained word embeddings (empty if not used)
+  QuantizedTable a_table;  // action embeddings
+  QuantizedTable r_table;  // relation embeddings
+  QuantizedTable p_table;  // POS tag embeddings (empty if not used)
+  Vec pbias;
+  QuantizedMatrix A, B, S, H, D, R;
+  QuantizedMatrix w2l;
+  Vec ib, cbias;
+  QuantizedMatrix p2a;
+  Vec action_start, abias;
+  Vec buffer_guard, stack_guard;
+  QuantizedMatrix p2l, t2l;
+  const std::unordered_map<unsigned, std::vector<float>>* pretrained;
+  ForbiddenFn forbidden;
+
+ private:
+  std::vector<QuantizedTable*> tables() {
+    return {&w_table, &t_table, &a_table, &r_table, &p_table};
+  }
+
+  std::vector<Vec*> vectors() {
+    return {&pbias, &ib, &cbias, &action_start, &abias, &buffer_guard, &stack_guard};
+  }
+
+  std::vector<QuantizedMatrix*> matrices() {
+    return {&A, &B, &S, &H, &D, &R, &w2l, &p2a, &p2l, &t2l};
+  }
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef JOB_RUNNER_H_
+#define JOB_RUNNER_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// The bookkeeping of a batch of input files parsed with one loaded model:
+// the list of files (from a manifest with one path per line, or all the
+// files of a directory), where each result goes, and a journal of the files
+// already done, so that a run that was interrupted skips them when started
+// again. A result is written to a temporary file next to the output and
+// renamed when complete, so an output file is either absent or complete,
+// and it is only journaled once renamed.
+class JobRunner {
+ public:
+  JobRunner(const std::string& source, const std::string& suffix, const std::string& journal_fname) :
+      source(source), suffix(suffix), journal_fname(journal_fname) {}
+
+  // the journal of a source, unless one is given
+  static std::string default_journal(const std::string& source) {
+    return is_directory(source) ? source + "/lstm-parse.journal" : source + ".journal";
+  }
+
+  // lists the files and reads the journal; false if the source cannot be read
+  bool load() {
+    files.clear();
+    if (is_directory(source)) {
+      DIR* dir = opendir(source.c_str());
+      if (!dir) return false;
+      while (struct dirent* e = readdir(dir)) {
+        const std::string name = e->d_name;
+        const std::string path = source + "/" + name;
+        if (name[0] == '.' || ends_with(name, suffix) || path == journal_fname || !is_file(path)) continue;
+        files.push_back(path);
+      }
+      closedir(dir);
+      std::sort(files.begin(), files.end());
+    } else {
+      std::ifstream in(source.c_str());
+      if (!in) return false;
+      std::string line;
+      while (getline(in, line))
+        if (!line.empty() && line[0] != '#') files.push_back(line);
+    }
+    std::set<std::string> journaled;
+    std::ifstream in(journal_fname.c_str());
+    std::string line;
+    while (getline(in, line)) journaled.insert(line.substr(0, line.find('\t')));
+    done.assign(files.size(), false);
+    for (unsigned i = 0; i < files.size(); ++i)
+      done[i] = journaled.count(files[i]) && is_file(output_of(files[i]));
+    journal.open(journal_fname.c_str(), std::ios_base::app);
+    start = std::chrono::steady_clock::now();
+    return bool(journal);
+  }
+
+  std::string output_of(const std::string& file) const { return file + suffix; }
+
+  // next to the output, with the same extension (for compression)
+  std::string temp_of(const std::string& file) const {
+    const std::string out = output_of(file);
+    const size_t slash = out.rfind('/');
+    const size_t name = slash == std::string::npos ? 0 : slash + 1;
+    return out.substr(0, name) + ".tmp." + out.substr(name);
+  }
+
+  // size of a file in kilobytes, for scheduling the largest files first
+  static unsigned kbytes(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size / 1024 + 1 : 1;
+  }
+
+  // renames the complete result into place and journals the file
+  bool commit(const std::string& file, unsigned sentences, unsigned long tokens, double ms) {
+    if (std::rename(temp_of(file).c_str(), output_of(file).c_str()) != 0) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    journal << file << '\t' << sentences << '\t' << tokens << '\t' << ms << std::endl;
+    ++files_done;
+    total_sentences += sentences;
+    total_tokens += tokens;
+    busy_ms += ms;
+    return true;
+  }
+
+  void failed(const std::string& file) {
+    std::remove(temp_of(file).c_str());
+    std::lock_guard<std::mutex> lock(mutex);
+    ++files_failed;
+  }
+
+  void report(std::ostream& out) const {
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const unsigned skipped = std::count(done.begin(), done.end(), true);
+    out << "Jobs: " << files_done << " files parsed, " << skipped << " already done, " << files_failed << " failed, "
+        << (files.size() - skipped - files_done - files_failed) << " left; " << total_sentences << " sentences, "
+        << total_tokens << " tokens in " << wall << " s (" << (wall > 0 ? total_sentences / wall : 0)
+        << " sentences/s, " << (wall > 0 ? total_tokens / wall : 0) << " tokens/s, "
+        << (files_done ? busy_ms / files_done : 0) << " ms per file)\n";
+  }
+
+  const std::string source, suffix, journal_fname;
+  std::vector<std::string> files;
+  std::vector<bool> done;  // by file, from the journal
+  unsigned files_done = 0, files_failed = 0;
+  unsigned long total_sentences = 0, total_tokens = 0;
+  double busy_ms = 0;
+
+ private:
+  static bool is_directory(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+  }
+  static bool is_file(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+  }
+  static bool ends_with(const std::string& s, const std::string& end) {
+    return !end.empty() && s.size() >= end.size() && s.compare(s.size() - end.size(), end.size(), end) == 0;
+  }
+
+  std::ofstream journal;
+  std::mutex mutex;
+  std::chrono::steady_clock::time_point start;
+};
+
+#endif
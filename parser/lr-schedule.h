@@ -0,0 +1,89 @@
+#ifndef LR_SCHEDULE_H_
+#define LR_SCHEDULE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+
+// The learning rate as a function of the epoch (fractional: sentences seen
+// over training sentences), set before every update:
+//   inverse:D   eta0 / (1 + D * completed epochs), cnn's update_epoch() decay
+//   constant    eta0
+//   step:E:F    multiplied by F every E epochs
+//   cosine:E    from eta0 down to 0 over E epochs, along half a cosine
+//   plateau:F:P multiplied by F whenever the dev UAS did not improve for P
+//               evaluations in a row
+// plus a linear warmup from 0 over the first warmup epochs.
+class LRSchedule {
+ public:
+  enum Type { INVERSE, CONSTANT, STEP, COSINE, PLATEAU };
+
+  static bool parse(const std::string& s, LRSchedule* schedule) {
+    std::istringstream in(s);
+    std::string name;
+    getline(in, name, ':');
+    LRSchedule r;
+    char colon;
+    if (name == "inverse") {
+      r.type = INVERSE;
+      if (!(in >> r.a)) return false;
+    } else if (name == "constant") {
+      r.type = CONSTANT;
+    } else if (name == "step") {
+      r.type = STEP;
+      if (!(in >> r.a >> colon >> r.b) || colon != ':' || r.a <= 0) return false;
+    } else if (name == "cosine") {
+      r.type = COSINE;
+      if (!(in >> r.a) || r.a <= 0) return false;
+    } else if (name == "plateau") {
+      r.type = PLATEAU;
+      if (!(in >> r.a >> colon >> r.b) || colon != ':' || r.b < 1) return false;
+    } else {
+      return false;
+    }
+    if (in.peek() != EOF) return false;
+    r.text = s;
+    *schedule = r;
+    return true;
+  }
+
+  float rate(float eta0, double epoch) const {
+    double f = 1;
+    switch (type) {
+      case INVERSE: f = 1 / (1 + a * std::floor(epoch)); break;
+      case CONSTANT: break;
+      case STEP: f = std::pow(b, std::floor(epoch / a)); break;
+      case COSINE: f = 0.5 * (1 + std::cos(M_PI * std::min(1., epoch / a))); break;
+      case PLATEAU: f = plateau_factor; break;
+    }
+    if (warmup > 0 && epoch < warmup) f *= epoch / warmup;
+    return eta0 * f;
+  }
+
+  // called after every dev evaluation
+  void dev_score(double uas) {
+    if (uas > best_uas) {
+      best_uas = uas;
+      bad_evals = 0;
+    } else if (type == PLATEAU && ++bad_evals >= unsigned(b)) {
+      plateau_factor *= a;
+      bad_evals = 0;
+    }
+  }
+
+  const std::string& str() const { return text; }
+
+  double warmup = 0;  // epochs
+  // state of plateau (saved in checkpoints)
+  double plateau_factor = 1;
+  double best_uas = -1;
+  unsigned bad_evals = 0;
+
+ private:
+  Type type = INVERSE;
+  double a = 0.08, b = 1;
+  std::string text = "inverse:0.08";
+};
+
+#endif
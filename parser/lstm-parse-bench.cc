@@ -0,0 +1,474 @@
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+
+#include <unistd.h>
+
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/program_options.hpp>
+
+#include "cnn/training.h"
+#include "lstm-parser.h"
+#include "math-backend.h"
+#include "sparse-trainer.h"
+
+// Microbenchmarks for the parser hot paths on a synthetic treebank, so that
+// runs are repeatable and do not depend on having a corpus around. Results
+// are written as JSON, one record per benchmark.
+
+namespace po = boost::program_options;
+
+const char* kBenchmarks[] = {"load_corpus", "load_embeddings", "model_save", "model_load",
+                             "is_action_forbidden", "compute_heads", "decode", "decode_graphless",
+                             "train_step", "matvec"};
+
+void InitCommandLine(int argc, char** argv, po::variables_map* conf) {
+  po::options_description opts("Configuration options");
+  opts.add_options()
+        ("sentences", po::value<unsigned>()->default_value(500), "Number of synthetic training sentences (the dev set gets a fifth as many)")
+        ("min_len", po::value<unsigned>()->default_value(5), "Minimum sentence length")
+        ("max_len", po::value<unsigned>()->default_value(40), "Maximum sentence length")
+        ("vocab", po::value<unsigned>()->default_value(5000), "Size of the synthetic vocabulary")
+        ("pretrained_vocab", po::value<unsigned>()->default_value(2000), "Number of words with a pretrained embedding (0 = none)")
+        ("npos", po::value<unsigned>()->default_value(45), "Number of POS tags")
+        ("nrels", po::value<unsigned>()->default_value(40), "Number of relation labels")
+        ("oov_rate", po::value<double>()->default_value(0.05), "Fraction of dev tokens outside of the training vocabulary")
+        ("seed", po::value<unsigned>()->default_value(1), "Seed of the synthetic corpus and embeddings generator")
+        ("repeat", po::value<unsigned>()->default_value(3), "Timed passes over the data for each benchmark")
+        ("warmup", po::value<unsigned>()->default_value(20), "Untimed sentences before each parsing benchmark")
+        ("benchmarks", po::value<string>()->default_value("all"), "Comma separated list of: all, load_corpus, load_embeddings, model_save, model_load, is_action_forbidden, compute_heads, decode, decode_graphless, train_step, matvec")
+        ("batch_sizes", po::value<string>()->default_value("1,8,32"), "matvec: comma separated numbers of vectors multiplied at once (1 = single-sentence decoding)")
+        ("math_threads", po::value<string>()->default_value("1"), "matvec: comma separated thread counts to compare; the other benchmarks use the first one")
+        ("workdir", po::value<string>()->default_value("/tmp"), "Directory for the generated corpus, embeddings and model")
+        ("keep_files", "Do not delete the generated files")
+        ("output,o", po::value<string>(), "Write the JSON report to this file instead of stdout")
+        ("use_pos_tags,P", "make POS tags visible to parser")
+        ("layers", po::value<unsigned>()->default_value(2), "number of LSTM layers")
+        ("action_dim", po::value<unsigned>()->default_value(16), "action embedding size")
+        ("input_dim", po::value<unsigned>()->default_value(32), "input embedding size")
+        ("hidden_dim", po::value<unsigned>()->default_value(64), "hidden dimension")
+        ("pretrained_dim", po::value<unsigned>()->default_value(50), "pretrained input dimension")
+        ("pos_dim", po::value<unsigned>()->default_value(12), "POS dimension")
+        ("rel_dim", po::value<unsigned>()->default_value(10), "relation dimension")
+        ("lstm_input_dim", po::value<unsigned>()->default_value(60), "LSTM input dimension")
+        ("help,h", "Help");
+  po::options_description dcmdline_options;
+  dcmdline_options.add(opts);
+  po::store(parse_command_line(argc, argv, dcmdline_options), *conf);
+  if (conf->count("help")) {
+    cerr << dcmdline_options << endl;
+    exit(1);
+  }
+}
+
+// a random walk over the transitions allowed by the parser; any such walk
+// builds a well-formed tree, and SWAP makes some of them non-projective. ROOT
+// is never swapped back, so that it stays the root as in the real oracle.
+vector<string> synthetic_actions(unsigned sent_len, unsigned nrels, mt19937& rng) {
+  vector<int> bufferi(sent_len + 1, 0), stacki(1, -999);
+  for (unsigned i = 0; i < sent_len; ++i)
+    bufferi[sent_len - i] = i;
+  bufferi[0] = -999;
+  static const char* kinds[] = {"SHIFT", "SWAP", "LEFT-ARC", "RIGHT-ARC"};
+  static const double weights[] = {5, 0.2, 2, 2};
+  uniform_int_distribution<unsigned> rel(0, nrels - 1);
+  vector<string> actions;
+  while (stacki.size() > 2 || bufferi.size() > 1) {
+    vector<double> w(4, 0);
+    for (unsigned k = 0; k < 4; ++k)
+      if (!ParserBuilder::IsActionForbidden(kinds[k], bufferi.size(), stacki.size(), stacki)) w[k] = weights[k];
+    if (stacki.back() == int(sent_len) - 1) w[1] = 0;
+    const unsigned k = discrete_distribution<unsigned>(w.begin(), w.end())(rng);
+    if (k == 0) {
+      actions.push_back("SHIFT");
+      stacki.push_back(bufferi.back());
+      bufferi.pop_back();
+    } else if (k == 1) {
+      actions.push_back("SWAP");
+      const int top = stacki.back();
+      stacki.pop_back();
+      bufferi.push_back(stacki.back());
+      stacki.back() = top;
+    } else {
+      const bool root = bufferi.size() == 1 && stacki.size() == 3;
+      actions.push_back(string(kinds[k]) + "(" + (root ? string("root") : "r" + to_string(rel(rng))) + ")");
+      const int top = stacki.back();
+      stacki.pop_back();
+      if (k == 2) stacki.back() = top;
+    }
+  }
+  return actions;
+}
+
+// writes a synthetic treebank in the oracle format read by cpyp::Corpus and
+// returns the number of tokens in it (not counting ROOT)
+unsigned long write_oracle(const string& fname, unsigned nsents, const po::variables_map& conf,
+                           double oov_rate, mt19937& rng) {
+  const unsigned min_len = conf["min_len"].as<unsigned>();
+  const unsigned max_len = max(min_len, conf["max_len"].as<unsigned>());
+  const unsigned vocab = conf["vocab"].as<unsigned>();
+  uniform_int_distribution<unsigned> len(min_len, max_len);
+  uniform_int_distribution<unsigned> pos(0, conf["npos"].as<unsigned>() - 1);
+  uniform_real_distribution<double> u(0, 1);
+  ofstream out(fname.c_str());
+  unsigned long tokens = 0;
+  for (unsigned s = 0; s < nsents; ++s) {
+    const unsigned n = len(rng);
+    out << "\n[][";
+    for (unsigned i = 0; i < n; ++i) {
+      const double x = u(rng);
+      if (x < oov_rate)
+        out << "oov" << unsigned(1e6 * u(rng));
+      else  // skewed towards frequent words
+        out << 'w' << unsigned(vocab * x * x);
+      out << "-p" << pos(rng) << ", ";
+    }
+    out << ROOT_SYMBOL << '-' << ROOT_SYMBOL << "]\n";
+    for (auto& a : synthetic_actions(n + 1, conf["nrels"].as<unsigned>(), rng))
+      out << a << "\n[][]\n";
+    tokens += n;
+  }
+  return tokens;
+}
+
+void write_embeddings(const string& fname, unsigned nwords, unsigned dim, mt19937& rng) {
+  normal_distribution<float> g(0, 1);
+  ofstream out(fname.c_str());
+  out << nwords << ' ' << dim << '\n';
+  out << fixed << setprecision(6);
+  for (unsigned i = 0; i < nwords; ++i) {
+    out << 'w' << i;
+    for (unsigned j = 0; j < dim; ++j) out << ' ' << g(rng);
+    out << '\n';
+  }
+}
+
+// timings of one benchmark; an item is a sentence for the parsing
+// benchmarks and a whole file for the loading/saving ones
+struct BenchResult {
+  string name;
+  vector<double> ms;
+  unsigned long sentences = 0;
+  unsigned long tokens = 0;
+  double flops = 0;  // per item, for the matrix products
+
+  explicit BenchResult(const string& name) : name(name) {}
+
+  double total_ms() const {
+    double t = 0;
+    for (auto x : ms) t += x;
+    return t;
+  }
+
+  double percentile(double q) const {
+    if (ms.empty()) return 0;
+    vector<double> sorted = ms;
+    sort(sorted.begin(), sorted.end());
+    return sorted[min<size_t>(sorted.size() - 1, q * sorted.size())];
+  }
+};
+
+typedef std::chrono::steady_clock BenchClock;
+
+double elapsed_ms(BenchClock::time_point start) {
+  return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+void write_json(ostream& out, const po::variables_map& conf, const vector<BenchResult>& results) {
+  out << "{\n  \"config\": {";
+  const char* keys[] = {"sentences", "min_len", "max_len", "vocab", "pretrained_vocab", "npos", "nrels",
+                        "seed", "repeat", "warmup", "layers", "input_dim", "hidden_dim", "action_dim",
+                        "lstm_input_dim", "pretrained_dim", "pos_dim", "rel_dim"};
+  for (auto k : keys)
+    out << '"' << k << "\": " << conf[k].as<unsigned>() << ", ";
+  out << "\"backend\": \"" << math_backend_name() << "\", \"math_threads\": \"" << conf["math_threads"].as<string>()
+      << "\", \"batch_sizes\": \"" << conf["batch_sizes"].as<string>() << "\", ";
+  out << "\"oov_rate\": " << conf["oov_rate"].as<double>()
+      << ", \"use_pos_tags\": " << (USE_POS ? "true" : "false")
+      << ", \"actions\": " << corpus.nactions << "},\n  \"benchmarks\": [";
+  for (unsigned i = 0; i < results.size(); ++i) {
+    const BenchResult& r = results[i];
+    const double total = r.total_ms();
+    out << (i ? "," : "") << "\n    {\"name\": \"" << r.name << "\", \"items\": " << r.ms.size()
+        << ", \"total_ms\": " << total
+        << ", \"p50_ms\": " << r.percentile(0.5) << ", \"p99_ms\": " << r.percentile(0.99);
+    if (r.sentences > 0 && total > 0)
+      out << ", \"sentences\": " << r.sentences << ", \"tokens\": " << r.tokens
+          << ", \"sentences_per_sec\": " << 1000. * r.sentences / total
+          << ", \"tokens_per_sec\": " << 1000. * r.tokens / total;
+    if (r.flops > 0 && total > 0)
+      out << ", \"gflops\": " << r.flops * r.ms.size() / total / 1e6;
+    out << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+  cnn::Initialize(argc, argv);
+
+  po::variables_map conf;
+  InitCommandLine(argc, argv, &conf);
+  USE_POS = conf.count("use_pos_tags");
+  LAYERS = conf["layers"].as<unsigned>();
+  INPUT_DIM = conf["input_dim"].as<unsigned>();
+  PRETRAINED_DIM = conf["pretrained_dim"].as<unsigned>();
+  HIDDEN_DIM = conf["hidden_dim"].as<unsigned>();
+  ACTION_DIM = conf["action_dim"].as<unsigned>();
+  LSTM_INPUT_DIM = conf["lstm_input_dim"].as<unsigned>();
+  POS_DIM = conf["pos_dim"].as<unsigned>();
+  REL_DIM = conf["rel_dim"].as<unsigned>();
+  const unsigned repeat = conf["repeat"].as<unsigned>();
+  const unsigned warmup = conf["warmup"].as<unsigned>();
+
+  set<string> benchmarks;
+  {
+    istringstream in(conf["benchmarks"].as<string>());
+    string name;
+    while (getline(in, name, ',')) {
+      if (name != "all" && find(begin(kBenchmarks), end(kBenchmarks), name) == end(kBenchmarks)) {
+        cerr << "Unknown benchmark: " << name << endl;
+        abort();
+      }
+      benchmarks.insert(name);
+    }
+  }
+  auto enabled = [&](const string& name) { return benchmarks.count("all") || benchmarks.count(name); };
+  vector<unsigned> batch_sizes, math_threads;
+  for (auto p : {make_pair("batch_sizes", &batch_sizes), make_pair("math_threads", &math_threads)}) {
+    istringstream in(conf[p.first].as<string>());
+    string n;
+    while (getline(in, n, ',')) p.second->push_back(max(1, atoi(n.c_str())));
+    if (p.second->empty()) p.second->push_back(1);
+  }
+  set_math_threads(math_threads[0]);
+
+  ostringstream prefix;
+  prefix << conf["workdir"].as<string>() << "/lstm-parse-bench-" << getpid();
+  const string train_fname = prefix.str() + ".train";
+  const string dev_fname = prefix.str() + ".dev";
+  const string words_fname = prefix.str() + ".words";
+  const string model_fname = prefix.str() + ".params";
+
+  mt19937 rng(conf["seed"].as<unsigned>());
+  const unsigned nsents = max(1u, conf["sentences"].as<unsigned>());
+  const unsigned long train_tokens = write_oracle(train_fname, nsents, conf, 0, rng);
+  const unsigned long dev_tokens = write_oracle(dev_fname, max(1u, nsents / 5), conf, conf["oov_rate"].as<double>(), rng);
+  const unsigned npretrained = min(conf["pretrained_vocab"].as<unsigned>(), conf["vocab"].as<unsigned>());
+  if (npretrained > 0) write_embeddings(words_fname, npretrained, PRETRAINED_DIM, rng);
+  cerr << "Synthetic corpus: " << nsents << " training sentences (" << train_tokens << " tokens), "
+       << nsents / 5 << " dev sentences (" << dev_tokens << " tokens) in " << prefix.str() << ".*" << endl;
+
+  vector<BenchResult> results;
+
+  if (enabled("load_corpus")) {
+    BenchResult r("load_corpus");
+    for (unsigned i = 0; i < repeat; ++i) {
+      cpyp::Corpus c;
+      auto start = BenchClock::now();
+      c.load_correct_actions(train_fname);
+      c.load_correct_actionsDev(dev_fname);
+      r.ms.push_back(elapsed_ms(start));
+      r.sentences += c.nsentences + c.nsentencesDev;
+      r.tokens += train_tokens + dev_tokens;
+    }
+    results.push_back(r);
+  }
+
+  corpus.load_correct_actions(train_fname);
+  const unsigned kUNK = corpus.get_or_add_word(cpyp::Corpus::UNK);
+  kROOT_SYMBOL = corpus.get_or_add_word(ROOT_SYMBOL);
+  if (npretrained > 0) {
+    pretrained[kUNK] = vector<float>(PRETRAINED_DIM, 0);
+    BenchResult r("load_embeddings");
+    for (unsigned i = 0; i < (enabled("load_embeddings") ? repeat : 1); ++i) {
+      ifstream in(words_fname.c_str());
+      auto start = BenchClock::now();
+      init_pretrained(in);
+      r.ms.push_back(elapsed_ms(start));
+    }
+    if (enabled("load_embeddings")) results.push_back(r);
+  }
+  corpus.load_correct_actionsDev(dev_fname);
+
+  set<unsigned> training_vocab;
+  for (auto& sent : corpus.sentences)
+    training_vocab.insert(sent.second.begin(), sent.second.end());
+  VOCAB_SIZE = corpus.nwords + 1;
+  ACTION_SIZE = corpus.nactions + 1;
+  POS_SIZE = corpus.npos + 10;
+  possible_actions.resize(corpus.nactions);
+  for (unsigned i = 0; i < corpus.nactions; ++i)
+    possible_actions[i] = i;
+
+  Model model;
+  ParserBuilder parser(&model, pretrained);
+
+  if (enabled("model_save") || enabled("model_load")) {
+    BenchResult save("model_save"), load("model_load");
+    for (unsigned i = 0; i < repeat; ++i) {
+      auto start = BenchClock::now();
+      {
+        ofstream out(model_fname.c_str());
+        boost::archive::text_oarchive oa(out);
+        oa << model;
+      }
+      save.ms.push_back(elapsed_ms(start));
+      start = BenchClock::now();
+      ifstream in(model_fname.c_str());
+      boost::archive::text_iarchive ia(in);
+      ia >> model;
+      load.ms.push_back(elapsed_ms(start));
+    }
+    if (enabled("model_save")) results.push_back(save);
+    if (enabled("model_load")) results.push_back(load);
+  }
+
+  // runs f on every sentence of a data set, repeat times, after a few
+  // untimed sentences to warm up caches and allocators
+  auto per_sentence = [&](BenchResult* r, const map<int,vector<unsigned>>& sentences, function<void(unsigned)> f) {
+    const unsigned n = sentences.size();
+    for (unsigned i = 0; i < min(warmup, n); ++i) f(i);
+    for (unsigned pass = 0; pass < repeat; ++pass) {
+      for (unsigned i = 0; i < n; ++i) {
+        auto start = BenchClock::now();
+        f(i);
+        r->ms.push_back(elapsed_ms(start));
+        r->sentences += 1;
+        r->tokens += sentences.find(i)->second.size() - 1;
+      }
+    }
+    results.push_back(*r);
+  };
+
+  if (enabled("is_action_forbidden")) {
+    // replays the oracle, checking every action at every step as the parser does
+    BenchResult r("is_action_forbidden");
+    unsigned long allowed = 0;
+    per_sentence(&r, corpus.sentences, [&](unsigned i) {
+      const unsigned n = corpus.sentences[i].size();
+      vector<int> bufferi(n + 1, 0), stacki(1, -999);
+      for (unsigned j = 0; j < n; ++j) bufferi[n - j] = j;
+      bufferi[0] = -999;
+      for (auto action : corpus.correct_act_sent[i]) {
+        for (auto a : possible_actions)
+          if (!ParserBuilder::IsActionForbidden(corpus.actions[a], bufferi.size(), stacki.size(), stacki)) ++allowed;
+        const string& s = corpus.actions[action];
+        if (s[0] == 'S' && s[1] == 'H') {
+          stacki.push_back(bufferi.back());
+          bufferi.pop_back();
+        } else if (s[0] == 'S' && s[1] == 'W') {
+          const int top = stacki.back();
+          stacki.pop_back();
+          bufferi.push_back(stacki.back());
+          stacki.back() = top;
+        } else {
+          const int top = stacki.back();
+          stacki.pop_back();
+          if (s[0] == 'L') stacki.back() = top;
+        }
+      }
+    });
+    cerr << "is_action_forbidden: " << allowed << " allowed actions" << endl;
+  }
+
+  if (enabled("compute_heads")) {
+    BenchResult r("compute_heads");
+    const ActionTable table(corpus.actions);
+    vector<int> heads, rels;
+    per_sentence(&r, corpus.sentences, [&](unsigned i) {
+      compute_heads(corpus.sentences[i].size(), corpus.correct_act_sent[i], table, &heads, &rels);
+    });
+  }
+
+  vector<vector<unsigned>> tsentences(corpus.nsentencesDev);
+  for (unsigned i = 0; i < corpus.nsentencesDev; ++i) {
+    tsentences[i] = corpus.sentencesDev[i];
+    for (auto& w : tsentences[i])
+      if (training_vocab.count(w) == 0) w = kUNK;
+  }
+
+  // the matrix-vector products of the parser (LSTM gates, parser state,
+  // composition and action scores) at its dimensions, one vector at a time
+  // as in decoding or a batch of them as in batched inference
+  if (enabled("matvec")) {
+    const unsigned kProducts = 1000;  // per timed item
+    struct Shape { const char* name; unsigned rows, cols; };
+    const Shape shapes[] = {{"lstm", HIDDEN_DIM, LSTM_INPUT_DIM + HIDDEN_DIM}, {"state", HIDDEN_DIM, HIDDEN_DIM},
+                            {"compose", LSTM_INPUT_DIM, 2 * LSTM_INPUT_DIM + REL_DIM}, {"scores", ACTION_SIZE, HIDDEN_DIM}};
+    for (unsigned threads : math_threads) {
+      set_math_threads(threads);
+      for (auto& shape : shapes) {
+        for (unsigned batch : batch_sizes) {
+          ostringstream name;
+          name << "matvec_" << shape.name << "_b" << batch << "_t" << threads;
+          BenchResult r(name.str());
+          r.flops = 2. * shape.rows * shape.cols * batch * kProducts;
+          const Eigen::MatrixXf w = Eigen::MatrixXf::Random(shape.rows, shape.cols);
+          Eigen::MatrixXf x = Eigen::MatrixXf::Random(shape.cols, batch);
+          Eigen::MatrixXf y(shape.rows, batch);
+          for (unsigned pass = 0; pass < repeat + 1; ++pass) {  // the first one warms up
+            auto start = BenchClock::now();
+            for (unsigned i = 0; i < kProducts; ++i) {
+              y.noalias() = w * x;
+              x(0, 0) = y(0, 0) * 1e-6f;  // keeps the products from being hoisted
+            }
+            if (pass) r.ms.push_back(elapsed_ms(start));
+          }
+          results.push_back(r);
+        }
+      }
+    }
+    set_math_threads(math_threads[0]);
+  }
+
+  if (enabled("decode")) {
+    BenchResult r("decode");
+    double right = 0;
+    per_sentence(&r, corpus.sentencesDev, [&](unsigned i) {
+      ComputationGraph& cg = new_sentence_graph();
+      parser.log_prob_parser(&cg, corpus.sentencesDev[i], tsentences[i], corpus.sentencesPosDev[i],
+                             vector<unsigned>(), corpus.actions, corpus.intToWords, &right);
+    });
+  }
+
+  if (enabled("decode_graphless")) {
+    BenchResult r("decode_graphless");
+    GreedyDecoder decoder(parser, pretrained);
+    per_sentence(&r, corpus.sentencesDev, [&](unsigned i) {
+      decoder.parse(corpus.sentencesDev[i], tsentences[i], corpus.sentencesPosDev[i], corpus.actions, possible_actions);
+    });
+  }
+
+  if (enabled("train_step")) {  // last, as it changes the model
+    BenchResult r("train_step");
+    SparseTrainer sgd(&model, SparseTrainer::SGD, 1e-6, 0.1, {parser.p_t});
+    double right = 0;
+    per_sentence(&r, corpus.sentences, [&](unsigned i) {
+      ComputationGraph& hg = new_sentence_graph();
+      parser.log_prob_parser(&hg, corpus.sentences[i], corpus.sentences[i], corpus.sentencesPos[i],
+                             corpus.correct_act_sent[i], corpus.actions, corpus.intToWords, &right);
+      as_scalar(hg.incremental_forward());
+      hg.backward();
+      sgd.update(1.0);
+    });
+  }
+
+  if (conf.count("output")) {
+    ofstream out(conf["output"].as<string>().c_str());
+    write_json(out, conf, results);
+  } else {
+    write_json(cout, conf, results);
+  }
+
+  if (!conf.count("keep_files"))
+    for (auto& f : {train_fname, dev_fname, words_fname, model_fname}) remove(f.c_str());
+}
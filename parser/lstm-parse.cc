@@ -1,14 +1,19 @@
 #include <cstdlib>
+#include <cstdio>
 #include <algorithm>
 #include <sstream>
 #include <iostream>
 #include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include <unordered_map>
 #include <unordered_set>
 
 #include <unistd.h>
 #include <signal.h>
+#include <sys/stat.h>
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/archive/text_oarchive.hpp>
@@ -18,38 +23,27 @@
 #include <boost/program_options.hpp>
 
 #include "cnn/training.h"
-#include "cnn/cnn.h"
-#include "cnn/expr.h"
-#include "cnn/lstm.h"
-#include "c2.h"
+#include "lr-schedule.h"
+#include "lstm-parser.h"
+#include "numa-placement.h"
+#include "math-backend.h"
+#include "checkpoint.h"
+#include "dev-schedule.h"
+#include "distillation.h"
+#include "job-runner.h"
+#include "sparse-trainer.h"
+#include "parse-cache.h"
+#include "parse-scheduler.h"
+#include "parse-trace.h"
+#include "parse-writer.h"
+#include "prefork.h"
+#include "training-metrics.h"
 
-cpyp::Corpus corpus;
 volatile bool requested_stop = false;
-unsigned LAYERS = 2;
-unsigned INPUT_DIM = 40;
-unsigned HIDDEN_DIM = 60;
-unsigned ACTION_DIM = 36;
-unsigned PRETRAINED_DIM = 50;
-unsigned LSTM_INPUT_DIM = 60;
-unsigned POS_DIM = 10;
-unsigned REL_DIM = 8;
-
-
-bool USE_POS = false;
-
-constexpr const char* ROOT_SYMBOL = "ROOT";
-unsigned kROOT_SYMBOL = 0;
-unsigned ACTION_SIZE = 0;
-unsigned VOCAB_SIZE = 0;
-unsigned POS_SIZE = 0;
-
-using namespace cnn::expr;
-using namespace cnn;
-using namespace std;
-namespace po = boost::program_options;
+volatile sig_atomic_t memory_report_requested = 0;
+volatile sig_atomic_t metrics_requested = 0;
 
-vector<unsigned> possible_actions;
-unordered_map<unsigned, vector<float>> pretrained;
+namespace po = boost::program_options;
 
 void InitCommandLine(int argc, char** argv, po::variables_map* conf) {
   po::options_description opts("Configuration options");
@@ -59,6 +53,8 @@ void InitCommandLine(int argc, char** argv, po::variables_map* conf) {
         ("test_data,p", po::value<string>(), "Test corpus")
         ("unk_strategy,o", po::value<unsigned>()->default_value(1), "Unknown word strategy: 1 = singletons become UNK with probability unk_prob")
         ("unk_prob,u", po::value<double>()->default_value(0.2), "Probably with which to replace singletons with UNK in training data")
+        ("oov_buckets", po::value<unsigned>()->default_value(0), "Word embedding rows shared by the words outside the training vocabulary, by a hash of the word (0 = a single UNK row); must be the same for training and parsing")
+        ("frozen_vocab", "Never add the words and POS tags of the -d data to the vocabulary: unseen words go to UNK or their OOV bucket")
         ("model,m", po::value<string>(), "Load saved model from this file")
         ("use_pos_tags,P", "make POS tags visible to parser")
         ("layers", po::value<unsigned>()->default_value(2), "number of LSTM layers")
@@ -72,6 +68,53 @@ void InitCommandLine(int argc, char** argv, po::variables_map* conf) {
         ("train,t", "Should training be run?")
         ("maxit,M", po::value<unsigned>()->default_value(8000), "Maximum number of training iterations")
         ("tolerance", po::value<double>()->default_value(-1.0), "Tolerance on dev uas for stopping training")
+        ("patience", po::value<unsigned>()->default_value(0), "Stop training after this many dev evaluations in a row without the moving average of the dev uas improving by more than --tolerance (0 = stop when two consecutive dev uas differ by less than --tolerance)")
+        ("patience_window", po::value<unsigned>()->default_value(3), "Dev evaluations in the moving average of --patience")
+        ("dev_every", po::value<string>()->default_value("blocks:25"), "When to evaluate on the dev data during training: blocks:N (of 100 updates), sentences:N (training sentences) or minutes:M")
+        ("dev_subsample", po::value<unsigned>()->default_value(0), "Evaluate on a fixed sample of this many dev sentences, stratified by length, and on the whole dev data only when the sample's uas is close to its best (0 = the whole dev data every time)")
+        ("optimizer", po::value<string>()->default_value("sgd"), "Training algorithm: sgd, momentum, adagrad or adam")
+        ("eta0", po::value<double>(), "Initial learning rate (default: 0.1 for sgd and adagrad, 0.01 for momentum, 0.001 for adam)")
+        ("lr_schedule", po::value<string>()->default_value("inverse:0.08"), "Learning rate schedule over epochs: inverse:D, constant, step:E:F, cosine:E or plateau:F:P (on dev UAS)")
+        ("lr_warmup", po::value<double>()->default_value(0), "Epochs of linear learning rate warmup")
+        ("target_uas", po::value<double>(), "Report the wall-clock time and sentences it took to first reach this dev UAS (e.g. 0.9)")
+        ("teacher_model", po::value<string>(), "Train on the action distributions of this (larger) model along the oracle (knowledge distillation)")
+        ("teacher_dims", po::value<string>(), "Dims of the teacher: layers,input,hidden,action,lstm_input,pos,rel (default: read from its parser_* file name)")
+        ("teacher_cache", po::value<string>(), "File caching the teacher's distributions over the training data (default: the teacher model file + .targets)")
+        ("distill_weight", po::value<double>()->default_value(0.5), "Weight of the teacher's distribution in the loss; the oracle action gets the rest (1 = teacher only)")
+        ("distill_temperature", po::value<double>()->default_value(1), "Temperature applied to the teacher's distribution")
+        ("distill_topk", po::value<unsigned>()->default_value(8), "Actions kept per step of the teacher's distribution")
+        ("bounded_memory", "Decode without a computation graph, keeping only the live parser state in memory")
+        ("max_parse_ms", po::value<double>()->default_value(0), "Per-sentence time budget at inference in ms; the rest of the tree is completed by rule (0 = no limit)")
+        ("max_transitions", po::value<unsigned>()->default_value(0), "Maximum number of model-predicted transitions per sentence at inference (0 = no limit)")
+        ("parse_cache", po::value<unsigned>()->default_value(0), "Cache the parses of up to this many distinct sentences (0 = no cache)")
+        ("quantize", po::value<string>(), "Quantize the decoder weights for inference: int8 or fp16 (implies --bounded_memory)")
+        ("save_decoder", po::value<string>(), "Write the graphless (possibly quantized) decoder to this file")
+        ("load_decoder", po::value<string>(), "Parse with a decoder written by --save_decoder instead of a cnn model")
+        ("compress", po::value<string>(), "Compress the state and composition matrices (S, B, A, H, D): lowrank:R or prune:F (fraction of columns kept); kept through training and used by the decoder")
+        ("compress_sweep", po::value<string>(), "Report dev UAS/LAS and per-sentence latency for each of a comma separated list of compression candidates")
+        ("checkpoint", po::value<string>(), "Save the full training state (model, trainer, position in the shuffled data, RNG) to this file periodically and when training stops")
+        ("checkpoint_every", po::value<double>()->default_value(10), "Minutes between two checkpoints")
+        ("resume", po::value<string>(), "Resume training from a checkpoint (and keep checkpointing to it unless --checkpoint is given)")
+        ("metrics_file", po::value<string>(), "Write training metrics (throughput, loss, dev UAS, RSS, ETA) to this file periodically and on SIGUSR1")
+        ("metrics_format", po::value<string>()->default_value("prometheus"), "Format of --metrics_file: prometheus (rewritten) or jsonl (appended)")
+        ("metrics_every", po::value<double>()->default_value(30), "Seconds between two writes of --metrics_file")
+        ("memory_report", "Print a breakdown of memory use at startup and at exit, with the peak computation graphs (SIGUSR2 prints one at any time)")
+        ("output", po::value<string>()->default_value("-"), "Write the parses to this file (- for standard output); .gz or .zst names are compressed")
+        ("output_format", po::value<string>()->default_value("conllx"), "Format of the parses: conllx, conllu, jsonl or binary")
+        ("punct_tags", po::value<string>(), "Space separated POS tags of punctuation for the scores without punctuation (default: tokens made of punctuation characters, as in eval.pl)")
+        ("eval_breakdown", "Report the scores without punctuation by relation and by sentence length")
+        ("profile", "Time the phases of parsing and training and report them at exit (needs a build with cmake -DPROFILE=ON)")
+        ("math_threads", po::value<unsigned>()->default_value(1), "Threads per matrix product (Eigen with -DUSE_OPENMP=ON, and the BLAS library); more only pays off for large products")
+        ("workers", po::value<unsigned>()->default_value(0), "Parse in this many forked worker processes sharing the loaded model (0 = parse in this process)")
+        ("threads", po::value<unsigned>()->default_value(1), "Parse the -p data on this many threads with the graphless decoder (implies --bounded_memory)")
+        ("schedule", po::value<string>()->default_value("longest_first"), "How --threads share the sentences: longest_first (with work stealing) or static (contiguous slices)")
+        ("numa", "With --threads: pin the threads to cores spread over the NUMA nodes, each using a copy of the decoder weights on its own node")
+        ("record_trace", po::value<string>(), "Record the parsed sentences, their arrival times and parse latencies to this trace file")
+        ("replay_trace", po::value<string>(), "Instead of parsing the -d data, parse the sentences of a trace at their recorded arrival times (on --threads threads) and report throughput and latency percentiles")
+        ("replay_speed", po::value<double>()->default_value(1), "Speed-up of the trace arrival times for --replay_trace (0 = all at once, for the maximum throughput)")
+        ("jobs", po::value<string>(), "Instead of the -d data, parse every file of this directory (or listed in this manifest, one path per line), each file in the format of -d, on --threads threads; each parse is written next to its input")
+        ("job_suffix", po::value<string>()->default_value(".parsed"), "Appended to the name of an input of --jobs for its parse (in --output_format; a .gz or .zst suffix compresses it)")
+        ("job_journal", po::value<string>(), "Journal of the files of --jobs already parsed, skipped when the run is started again (default: the manifest + .journal, or lstm-parse.journal in the directory)")
         ("words,w", po::value<string>(), "Pretrained word embeddings")
         ("help,h", "Help");
   po::options_description dcmdline_options;
@@ -87,432 +130,108 @@ void InitCommandLine(int argc, char** argv, po::variables_map* conf) {
   }
 }
 
-struct ParserBuilder {
-
-  LSTMBuilder stack_lstm; // (layers, input, hidden, trainer)
-  LSTMBuilder buffer_lstm;
-  LSTMBuilder action_lstm;
-  LookupParameters* p_w; // word embeddings
-  LookupParameters* p_t; // pretrained word embeddings (not updated)
-  LookupParameters* p_a; // input action embeddings
-  LookupParameters* p_r; // relation embeddings
-  LookupParameters* p_p; // pos tag embeddings
-  Parameters* p_pbias; // parser state bias
-  Parameters* p_A; // action lstm to parser state
-  Parameters* p_B; // buffer lstm to parser state
-  Parameters* p_S; // stack lstm to parser state
-  Parameters* p_H; // head matrix for composition function
-  Parameters* p_D; // dependency matrix for composition function
-  Parameters* p_R; // relation matrix for composition function
-  Parameters* p_w2l; // word to LSTM input
-  Parameters* p_p2l; // POS to LSTM input
-  Parameters* p_t2l; // pretrained word embeddings to LSTM input
-  Parameters* p_ib; // LSTM input bias
-  Parameters* p_cbias; // composition function bias
-  Parameters* p_p2a;   // parser state to action
-  Parameters* p_action_start;  // action bias
-  Parameters* p_abias;  // action bias
-  Parameters* p_buffer_guard;  // end of buffer
-  Parameters* p_stack_guard;  // end of stack
-
-  explicit ParserBuilder(Model* model, const unordered_map<unsigned, vector<float>>& pretrained) :
-      stack_lstm(LAYERS, LSTM_INPUT_DIM, HIDDEN_DIM, model),
-      buffer_lstm(LAYERS, LSTM_INPUT_DIM, HIDDEN_DIM, model),
-      action_lstm(LAYERS, ACTION_DIM, HIDDEN_DIM, model),
-      p_w(model->add_lookup_parameters(VOCAB_SIZE, Dim(INPUT_DIM, 1))),
-      p_a(model->add_lookup_parameters(ACTION_SIZE, Dim(ACTION_DIM, 1))),
-      p_r(model->add_lookup_parameters(ACTION_SIZE, Dim(REL_DIM, 1))),
-      p_pbias(model->add_parameters(Dim(HIDDEN_DIM, 1))),
-      p_A(model->add_parameters(Dim(HIDDEN_DIM, HIDDEN_DIM))),
-      p_B(model->add_parameters(Dim(HIDDEN_DIM, HIDDEN_DIM))),
-      p_S(model->add_parameters(Dim(HIDDEN_DIM, HIDDEN_DIM))),
-      p_H(model->add_parameters(Dim(LSTM_INPUT_DIM, LSTM_INPUT_DIM))),
-      p_D(model->add_parameters(Dim(LSTM_INPUT_DIM, LSTM_INPUT_DIM))),
-      p_R(model->add_parameters(Dim(LSTM_INPUT_DIM, REL_DIM))),
-      p_w2l(model->add_parameters(Dim(LSTM_INPUT_DIM, INPUT_DIM))),
-      p_ib(model->add_parameters(Dim(LSTM_INPUT_DIM, 1))),
-      p_cbias(model->add_parameters(Dim(LSTM_INPUT_DIM, 1))),
-      p_p2a(model->add_parameters(Dim(ACTION_SIZE, HIDDEN_DIM))),
-      p_action_start(model->add_parameters(Dim(ACTION_DIM, 1))),
-      p_abias(model->add_parameters(Dim(ACTION_SIZE, 1))),
-
-      p_buffer_guard(model->add_parameters(Dim(LSTM_INPUT_DIM, 1))),
-      p_stack_guard(model->add_parameters(Dim(LSTM_INPUT_DIM, 1))) {
-    if (USE_POS) {
-      p_p = model->add_lookup_parameters(POS_SIZE, Dim(POS_DIM, 1));
-      p_p2l = model->add_parameters(Dim(LSTM_INPUT_DIM, POS_DIM));
-    }
-    if (pretrained.size() > 0) {
-      p_t = model->add_lookup_parameters(VOCAB_SIZE, Dim(PRETRAINED_DIM, 1));
-      for (auto it : pretrained)
-        p_t->Initialize(it.first, it.second);
-      p_t2l = model->add_parameters(Dim(LSTM_INPUT_DIM, PRETRAINED_DIM));
-    } else {
-      p_t = nullptr;
-      p_t2l = nullptr;
-    }
-  }
-
-static bool IsActionForbidden(const string& a, unsigned bsize, unsigned ssize, const vector<int>& stacki) {
-  if (a[1]=='W' && ssize<3) return true;
-  if (a[1]=='W') {
-        int top=stacki[stacki.size()-1];
-        int sec=stacki[stacki.size()-2];
-        if (sec>top) return true;
+void signal_callback_handler(int signum) {
+  const char* name = signum == SIGTERM ? "SIGTERM" : "SIGINT";
+  if (requested_stop) {
+    cerr << "\nReceived " << name << " again, quitting.\n";
+    _exit(1);
   }
+  cerr << "\nReceived " << name << " terminating optimization early...\n";
+  requested_stop = true;
+}
 
-  bool is_shift = (a[0] == 'S' && a[1]=='H');
-  bool is_reduce = !is_shift;
-  if (is_shift && bsize == 1) return true;
-  if (is_reduce && ssize < 3) return true;
-  if (bsize == 2 && // ROOT is the only thing remaining on buffer
-      ssize > 2 && // there is more than a single element on the stack
-      is_shift) return true;
-  // only attach left to ROOT
-  if (bsize == 1 && ssize == 3 && a[0] == 'R') return true;
-  return false;
+void memory_report_handler(int /* signum */) {
+  memory_report_requested = 1;
 }
 
-// take a vector of actions and return a parse tree (labeling of every
-// word position with its head's position)
-static map<int,int> compute_heads(unsigned sent_len, const vector<unsigned>& actions, const vector<string>& setOfActions, map<int,string>* pr = nullptr) {
-  map<int,int> heads;
-  map<int,string> r;
-  map<int,string>& rels = (pr ? *pr : r);
-  for(unsigned i=0;i<sent_len;i++) { heads[i]=-1; rels[i]="ERROR"; }
-  vector<int> bufferi(sent_len + 1, 0), stacki(1, -999);
-  for (unsigned i = 0; i < sent_len; ++i)
-    bufferi[sent_len - i] = i;
-  bufferi[0] = -999;
-  for (auto action: actions) { // loop over transitions for sentence
-    const string& actionString=setOfActions[action];
-    const char ac = actionString[0];
-    const char ac2 = actionString[1];
-    if (ac =='S' && ac2=='H') {  // SHIFT
-      assert(bufferi.size() > 1); // dummy symbol means > 1 (not >= 1)
-      stacki.push_back(bufferi.back());
-      bufferi.pop_back();
-    } else if (ac=='S' && ac2=='W') { // SWAP
-      assert(stacki.size() > 2);
-      unsigned ii = 0, jj = 0;
-      jj = stacki.back();
-      stacki.pop_back();
-      ii = stacki.back();
-      stacki.pop_back();
-      bufferi.push_back(ii);
-      stacki.push_back(jj);
-    } else { // LEFT or RIGHT
-      assert(stacki.size() > 2); // dummy symbol means > 2 (not >= 2)
-      assert(ac == 'L' || ac == 'R');
-      unsigned depi = 0, headi = 0;
-      (ac == 'R' ? depi : headi) = stacki.back();
-      stacki.pop_back();
-      (ac == 'R' ? headi : depi) = stacki.back();
-      stacki.pop_back();
-      stacki.push_back(headi);
-      heads[depi] = headi;
-      rels[depi] = actionString;
-    }
-  }
-  assert(bufferi.size() == 1);
-  //assert(stacki.size() == 2);
-  return heads;
+void metrics_handler(int /* signum */) {
+  metrics_requested = 1;
 }
 
-// *** if correct_actions is empty, this runs greedy decoding ***
-// returns parse actions for input sentence (in training just returns the reference)
-// OOV handling: raw_sent will have the actual words
-//               sent will have words replaced by appropriate UNK tokens
-// this lets us use pretrained embeddings, when available, for words that were OOV in the
-// parser training data
-vector<unsigned> log_prob_parser(ComputationGraph* hg,
-                     const vector<unsigned>& raw_sent,  // raw sentence
-                     const vector<unsigned>& sent,  // sent with oovs replaced
-                     const vector<unsigned>& sentPos,
-                     const vector<unsigned>& correct_actions,
-                     const vector<string>& setOfActions,
-                     const map<unsigned, std::string>& intToWords,
-                     double *right) {
-    vector<unsigned> results;
-    const bool build_training_graph = correct_actions.size() > 0;
-
-    stack_lstm.new_graph(*hg);
-    buffer_lstm.new_graph(*hg);
-    action_lstm.new_graph(*hg);
-    stack_lstm.start_new_sequence();
-    buffer_lstm.start_new_sequence();
-    action_lstm.start_new_sequence();
-    // variables in the computation graph representing the parameters
-    Expression pbias = parameter(*hg, p_pbias);
-    Expression H = parameter(*hg, p_H);
-    Expression D = parameter(*hg, p_D);
-    Expression R = parameter(*hg, p_R);
-    Expression cbias = parameter(*hg, p_cbias);
-    Expression S = parameter(*hg, p_S);
-    Expression B = parameter(*hg, p_B);
-    Expression A = parameter(*hg, p_A);
-    Expression ib = parameter(*hg, p_ib);
-    Expression w2l = parameter(*hg, p_w2l);
-    Expression p2l;
-    if (USE_POS)
-      p2l = parameter(*hg, p_p2l);
-    Expression t2l;
-    if (p_t2l)
-      t2l = parameter(*hg, p_t2l);
-    Expression p2a = parameter(*hg, p_p2a);
-    Expression abias = parameter(*hg, p_abias);
-    Expression action_start = parameter(*hg, p_action_start);
-
-    action_lstm.add_input(action_start);
-
-    vector<Expression> buffer(sent.size() + 1);  // variables representing word embeddings (possibly including POS info)
-    vector<int> bufferi(sent.size() + 1);  // position of the words in the sentence
-    // precompute buffer representation from left to right
-
-    for (unsigned i = 0; i < sent.size(); ++i) {
-      assert(sent[i] < VOCAB_SIZE);
-      Expression w =lookup(*hg, p_w, sent[i]);
-
-      vector<Expression> args = {ib, w2l, w}; // learn embeddings
-      if (USE_POS) { // learn POS tag?
-        Expression p = lookup(*hg, p_p, sentPos[i]);
-        args.push_back(p2l);
-        args.push_back(p);
-      }
-      if (p_t && pretrained.count(raw_sent[i])) {  // include fixed pretrained vectors?
-        Expression t = const_lookup(*hg, p_t, raw_sent[i]);
-        args.push_back(t2l);
-        args.push_back(t);
-      }
-      buffer[sent.size() - i] = rectify(affine_transform(args));
-      bufferi[sent.size() - i] = i;
-    }
-    // dummy symbol to represent the empty buffer
-    buffer[0] = parameter(*hg, p_buffer_guard);
-    bufferi[0] = -999;
-    for (auto& b : buffer)
-      buffer_lstm.add_input(b);
-
-    vector<Expression> stack;  // variables representing subtree embeddings
-    vector<int> stacki; // position of words in the sentence of head of subtree
-    stack.push_back(parameter(*hg, p_stack_guard));
-    stacki.push_back(-999); // not used for anything
-    // drive dummy symbol on stack through LSTM
-    stack_lstm.add_input(stack.back());
-    vector<Expression> log_probs;
-    string rootword;
-    unsigned action_count = 0;  // incremented at each prediction
-    while(stack.size() > 2 || buffer.size() > 1) {
-      // get list of possible actions for the current parser state
-      vector<unsigned> current_valid_actions;
-      for (auto a: possible_actions) {
-        if (IsActionForbidden(setOfActions[a], buffer.size(), stack.size(), stacki))
-          continue;
-        current_valid_actions.push_back(a);
-      }
+// the process-wide counters (parse budget, parse cache, profiler) as plain
+// data: a prefork worker hands what it added to them while parsing a job to
+// the supervisor, which adds it to its own
+struct WorkerCounters {
+  unsigned long degradation[5];  // as in DegradationCounters
+  unsigned long cache[4];  // hits, misses, evictions, invalidations
+  Profiler::Snapshot profile;
 
-      // p_t = pbias + S * slstm + B * blstm + A * almst
-      Expression p_t = affine_transform({pbias, S, stack_lstm.back(), B, buffer_lstm.back(), A, action_lstm.back()});
-      Expression nlp_t = rectify(p_t);
-      // r_t = abias + p2a * nlp
-      Expression r_t = affine_transform({abias, p2a, nlp_t});
-
-      // adist = log_softmax(r_t, current_valid_actions)
-      Expression adiste = log_softmax(r_t, current_valid_actions);
-      vector<float> adist = as_vector(hg->incremental_forward());
-      double best_score = adist[current_valid_actions[0]];
-      unsigned best_a = current_valid_actions[0];
-      for (unsigned i = 1; i < current_valid_actions.size(); ++i) {
-        if (adist[current_valid_actions[i]] > best_score) {
-          best_score = adist[current_valid_actions[i]];
-          best_a = current_valid_actions[i];
-        }
-      }
-      unsigned action = best_a;
-      if (build_training_graph) {  // if we have reference actions (for training) use the reference action
-        action = correct_actions[action_count];
-        if (best_a == action) { (*right)++; }
-      }
-      ++action_count;
-      log_probs.push_back(pick(adiste, action));
-      results.push_back(action);
-
-      // add current action to action LSTM
-      Expression actione = lookup(*hg, p_a, action);
-      action_lstm.add_input(actione);
-
-      // get relation embedding from action (TODO: convert to relation from action?)
-      Expression relation = lookup(*hg, p_r, action);
-
-      // do action
-      const string& actionString=setOfActions[action];
-      const char ac = actionString[0];
-      const char ac2 = actionString[1];
-
-
-      if (ac =='S' && ac2=='H') {  // SHIFT
-        assert(buffer.size() > 1); // dummy symbol means > 1 (not >= 1)
-        stack.push_back(buffer.back());
-        stack_lstm.add_input(buffer.back());
-        buffer.pop_back();
-        buffer_lstm.rewind_one_step();
-        stacki.push_back(bufferi.back());
-        bufferi.pop_back();
-      } else if (ac=='S' && ac2=='W'){ //SWAP --- Miguel
-        assert(stack.size() > 2); // dummy symbol means > 2 (not >= 2)
-
-        Expression toki, tokj;
-        unsigned ii = 0, jj = 0;
-        tokj=stack.back();
-        jj=stacki.back();
-        stack.pop_back();
-        stacki.pop_back();
-
-        toki=stack.back();
-        ii=stacki.back();
-        stack.pop_back();
-        stacki.pop_back();
-
-        buffer.push_back(toki);
-        bufferi.push_back(ii);
-
-        stack_lstm.rewind_one_step();
-        stack_lstm.rewind_one_step();
-
-        buffer_lstm.add_input(buffer.back());
-
-        stack.push_back(tokj);
-        stacki.push_back(jj);
-
-        stack_lstm.add_input(stack.back());
-      } else { // LEFT or RIGHT
-        assert(stack.size() > 2); // dummy symbol means > 2 (not >= 2)
-        assert(ac == 'L' || ac == 'R');
-        Expression dep, head;
-        unsigned depi = 0, headi = 0;
-        (ac == 'R' ? dep : head) = stack.back();
-        (ac == 'R' ? depi : headi) = stacki.back();
-        stack.pop_back();
-        stacki.pop_back();
-        (ac == 'R' ? head : dep) = stack.back();
-        (ac == 'R' ? headi : depi) = stacki.back();
-        stack.pop_back();
-        stacki.pop_back();
-        if (headi == sent.size() - 1) rootword = intToWords.find(sent[depi])->second;
-        // composed = cbias + H * head + D * dep + R * relation
-        Expression composed = affine_transform({cbias, H, head, D, dep, R, relation});
-        Expression nlcomposed = tanh(composed);
-        stack_lstm.rewind_one_step();
-        stack_lstm.rewind_one_step();
-        stack_lstm.add_input(nlcomposed);
-        stack.push_back(nlcomposed);
-        stacki.push_back(headi);
-      }
+  static WorkerCounters now(const ParseCache* parse_cache) {
+    WorkerCounters c;
+    const DegradationCounters& d = degradation_counters;
+    const unsigned long degradation[5] = {d.sentences, d.degraded, d.forced_transitions, d.deadline_hits,
+                                          d.transition_cap_hits};
+    copy(degradation, degradation + 5, c.degradation);
+    fill(c.cache, c.cache + 4, 0);
+    if (parse_cache) {
+      const unsigned long cache[4] = {parse_cache->hits, parse_cache->misses, parse_cache->evictions,
+                                      parse_cache->invalidations};
+      copy(cache, cache + 4, c.cache);
     }
-    assert(stack.size() == 2); // guard symbol, root
-    assert(stacki.size() == 2);
-    assert(buffer.size() == 1); // guard symbol
-    assert(bufferi.size() == 1);
-    Expression tot_neglogprob = -sum(log_probs);
-    assert(tot_neglogprob.pg != nullptr);
-    return results;
+    c.profile = profiler.snapshot();
+    return c;
   }
-};
 
-void signal_callback_handler(int /* signum */) {
-  if (requested_stop) {
-    cerr << "\nReceived SIGINT again, quitting.\n";
-    _exit(1);
+  // the counts added since start
+  WorkerCounters since(const WorkerCounters& start) const {
+    WorkerCounters c;
+    for (unsigned i = 0; i < 5; ++i) c.degradation[i] = degradation[i] - start.degradation[i];
+    for (unsigned i = 0; i < 4; ++i) c.cache[i] = cache[i] - start.cache[i];
+    c.profile = Profiler::difference(profile, start.profile);
+    return c;
   }
-  cerr << "\nReceived SIGINT terminating optimization early...\n";
-  requested_stop = true;
-}
 
-template<typename T>
-unsigned compute_correct(const map<int,T>& ref, const map<int,T>& hyp, unsigned len) {
-  unsigned res = 0;
-  for (unsigned i = 0; i < len; ++i) {
-    auto ri = ref.find(i);
-    auto hi = hyp.find(i);
-    assert(ri != ref.end());
-    assert(hi != hyp.end());
-    if (ri->second == hi->second) ++res;
-  }
-  return res;
-}
+  // adds the counts to those of this process
+  void add_to(ParseCache* parse_cache) const {
+    DegradationCounters& d = degradation_counters;
+    d.sentences += degradation[0];
+    d.degraded += degradation[1];
+    d.forced_transitions += degradation[2];
+    d.deadline_hits += degradation[3];
+    d.transition_cap_hits += degradation[4];
+    if (parse_cache) {
+      parse_cache->hits += cache[0];
+      parse_cache->misses += cache[1];
+      parse_cache->evictions += cache[2];
+      parse_cache->invalidations += cache[3];
+    }
+    profiler.merge(profile);
+  }
+};
 
-template<typename T1, typename T2>
-unsigned compute_correct(const map<int,T1>& ref1, const map<int,T1>& hyp1,
-                         const map<int,T2>& ref2, const map<int,T2>& hyp2, unsigned len) {
-  unsigned res = 0;
-  for (unsigned i = 0; i < len; ++i) {
-    auto r1 = ref1.find(i);
-    auto h1 = hyp1.find(i);
-    auto r2 = ref2.find(i);
-    auto h2 = hyp2.find(i);
-    assert(r1 != ref1.end());
-    assert(h1 != hyp1.end());
-    assert(r2 != ref2.end());
-    assert(h2 != hyp2.end());
-    if (r1->second == h1->second && r2->second == h2->second) ++res;
-  }
-  return res;
-}
+// parses of the prefork workers, left in shared memory for the supervisor
+// to evaluate and write in order
+struct ForkedParses {
+  enum State : char { MISSING, PARSED, DEGRADED };
 
-void output_conll(const vector<unsigned>& sentence, const vector<unsigned>& pos,
-                  const vector<string>& sentenceUnkStrings,
-                  const map<unsigned, string>& intToWords,
-                  const map<unsigned, string>& intToPos,
-                  const map<int,int>& hyp, const map<int,string>& rel_hyp) {
-  for (unsigned i = 0; i < (sentence.size()-1); ++i) {
-    auto index = i + 1;
-    assert(i < sentenceUnkStrings.size() &&
-           ((sentence[i] == corpus.get_or_add_word(cpyp::Corpus::UNK) &&
-             sentenceUnkStrings[i].size() > 0) ||
-            (sentence[i] != corpus.get_or_add_word(cpyp::Corpus::UNK) &&
-             sentenceUnkStrings[i].size() == 0 &&
-             intToWords.find(sentence[i]) != intToWords.end())));
-    string wit = (sentenceUnkStrings[i].size() > 0)?
-      sentenceUnkStrings[i] : intToWords.find(sentence[i])->second;
-    auto pit = intToPos.find(pos[i]);
-    assert(hyp.find(i) != hyp.end());
-    auto hyp_head = hyp.find(i)->second + 1;
-    if (hyp_head == (int)sentence.size()) hyp_head = 0;
-    auto hyp_rel_it = rel_hyp.find(i);
-    assert(hyp_rel_it != rel_hyp.end());
-    auto hyp_rel = hyp_rel_it->second;
-    size_t first_char_in_rel = hyp_rel.find('(') + 1;
-    size_t last_char_in_rel = hyp_rel.rfind(')') - 1;
-    hyp_rel = hyp_rel.substr(first_char_in_rel, last_char_in_rel - first_char_in_rel + 1);
-    cout << index << '\t'       // 1. ID
-         << wit << '\t'         // 2. FORM
-         << "_" << '\t'         // 3. LEMMA
-         << "_" << '\t'         // 4. CPOSTAG
-         << pit->second << '\t' // 5. POSTAG
-         << "_" << '\t'         // 6. FEATS
-         << hyp_head << '\t'    // 7. HEAD
-         << hyp_rel << '\t'     // 8. DEPREL
-         << "_" << '\t'         // 9. PHEAD
-         << "_" << endl;        // 10. PDEPREL
-  }
-  cout << endl;
-}
+  ForkedParses(const map<int, vector<unsigned>>& sentences, unsigned jobs) :
+      offsets(1, 0), state(sentences.size()), right(sentences.size()), heads(total(sentences)), rels(heads.size()),
+      counters(jobs) {
+    for (unsigned i = 0; i < sentences.size(); ++i)
+      offsets.push_back(offsets.back() + sentences.find(i)->second.size());
+  }
 
-void init_pretrained(istream &in) {
-  string line;
-  vector<float> v(PRETRAINED_DIM, 0);
-  string word;
-  while (getline(in, line)) {
-    if (word.empty() && line.find('.') == std::string::npos)
-      continue; // first line contains vocabulary size and dimensions
-    istringstream lin(line);
-    lin >> word;
-    for (unsigned i = 0; i < PRETRAINED_DIM; ++i) lin >> v[i];
-    unsigned id = corpus.get_or_add_word(word);
-    pretrained[id] = v;
+  void store(unsigned sii, const vector<int>& h, const vector<int>& r) {
+    copy(h.begin(), h.end(), &heads[offsets[sii]]);
+    copy(r.begin(), r.end(), &rels[offsets[sii]]);
+  }
+  void load(unsigned sii, vector<int>* h, vector<int>* r) const {
+    h->assign(&heads[offsets[sii]], &heads[offsets[sii]] + (offsets[sii + 1] - offsets[sii]));
+    r->assign(&rels[offsets[sii]], &rels[offsets[sii]] + (offsets[sii + 1] - offsets[sii]));
+  }
+
+  static size_t total(const map<int, vector<unsigned>>& sentences) {
+    size_t n = 0;
+    for (auto& s : sentences) n += s.second.size();
+    return n;
   }
-}
 
+  vector<size_t> offsets;
+  SharedArray<State> state;
+  SharedArray<float> right;
+  SharedArray<int> heads, rels;
+  SharedArray<WorkerCounters> counters;  // by job, set when the job is done
+};
 
 int main(int argc, char** argv) {
   cnn::Initialize(argc, argv);
@@ -525,6 +244,54 @@ int main(int argc, char** argv) {
   po::variables_map conf;
   InitCommandLine(argc, argv, &conf);
   USE_POS = conf.count("use_pos_tags");
+  set_math_threads(conf["math_threads"].as<unsigned>());
+  cerr << "Matrix backend: " << math_backend_name() << ", " << conf["math_threads"].as<unsigned>() << " thread(s)\n";
+  if (conf.count("profile")) {
+#ifdef PARSER_PROFILE
+    profiler.enabled = true;
+#else
+    cerr << "Ignoring --profile: the parser was built without profiling (cmake -DPROFILE=ON)\n";
+#endif
+  }
+  WeightType quantize = FLOAT32;
+  if (conf.count("quantize") && !parse_weight_type(conf["quantize"].as<string>(), &quantize)) {
+    cerr << "Unknown weight type for --quantize: " << conf["quantize"].as<string>() << endl;
+    abort();
+  }
+  CompressionSpec compress_spec;
+  if (conf.count("compress") && !CompressionSpec::parse(conf["compress"].as<string>(), &compress_spec)) {
+    cerr << "Bad --compress specification: " << conf["compress"].as<string>() << endl;
+    abort();
+  }
+  vector<CompressionSpec> compress_candidates;
+  if (conf.count("compress_sweep") &&
+      !CompressionSpec::parse_list(conf["compress_sweep"].as<string>(), &compress_candidates)) {
+    cerr << "Bad --compress_sweep specification: " << conf["compress_sweep"].as<string>() << endl;
+    abort();
+  }
+  ParseWriter::Format output_format;
+  if (!ParseWriter::parse_format(conf["output_format"].as<string>(), &output_format)) {
+    cerr << "Unknown --output_format: " << conf["output_format"].as<string>() << endl;
+    abort();
+  }
+  ParseScheduler::Policy schedule;
+  if (!ParseScheduler::parse_policy(conf["schedule"].as<string>(), &schedule)) {
+    cerr << "Unknown --schedule: " << conf["schedule"].as<string>() << endl;
+    abort();
+  }
+  const unsigned nthreads = max(1u, conf["threads"].as<unsigned>());
+  if (nthreads > 1 && conf["workers"].as<unsigned>() > 0) {
+    cerr << "--threads cannot be combined with --workers\n";
+    abort();
+  }
+  for (const char* option : {"record_trace", "replay_trace", "jobs"}) {
+    if (conf.count(option) && conf["workers"].as<unsigned>() > 0) {
+      cerr << "--" << option << " cannot be combined with --workers\n";
+      abort();
+    }
+  }
+  const bool bounded_memory = conf.count("bounded_memory") || quantize != FLOAT32 || conf.count("save_decoder")
+      || compress_spec.type != FLOAT32 || nthreads > 1;
 
   LAYERS = conf["layers"].as<unsigned>();
   INPUT_DIM = conf["input_dim"].as<unsigned>();
@@ -534,6 +301,7 @@ int main(int argc, char** argv) {
   LSTM_INPUT_DIM = conf["lstm_input_dim"].as<unsigned>();
   POS_DIM = conf["pos_dim"].as<unsigned>();
   REL_DIM = conf["rel_dim"].as<unsigned>();
+  OOV_BUCKETS = conf["oov_buckets"].as<unsigned>();
   const unsigned unk_strategy = conf["unk_strategy"].as<unsigned>();
   cerr << "Unknown word strategy: ";
   if (unk_strategy == 1) {
@@ -560,14 +328,18 @@ int main(int argc, char** argv) {
      << '_' << REL_DIM
      << "-pid" << getpid() << ".params";
   int best_correct_heads = 0;
-  const string fname = os.str();
+  string fname = os.str();
   cerr << "Writing parameters to file: " << fname << endl;
   bool softlinkCreated = false;
-  corpus.load_correct_actions(conf["training_data"].as<string>());
+  {
+    PROFILE_SCOPE(PROFILE_LOAD);
+    corpus.load_correct_actions(conf["training_data"].as<string>());
+  }
   const unsigned kUNK = corpus.get_or_add_word(cpyp::Corpus::UNK);
   kROOT_SYMBOL = corpus.get_or_add_word(ROOT_SYMBOL);
 
   if (conf.count("words")) {
+    PROFILE_SCOPE(PROFILE_LOAD);
     pretrained[kUNK] = vector<float>(PRETRAINED_DIM, 0);
     const string& words_fname = conf["words"].as<string>();
     cerr << "Loading from " << words_fname << " with " << PRETRAINED_DIM << " dimensions\n";
@@ -602,23 +374,351 @@ int main(int argc, char** argv) {
   for (unsigned i = 0; i < corpus.nactions; ++i)
     possible_actions[i] = i;
 
+  ParseBudget budget;
+  budget.max_ms = conf["max_parse_ms"].as<double>();
+  budget.max_transitions = conf["max_transitions"].as<unsigned>();
+  if (budget.limited()) {
+    vector<vector<unsigned>> oracle;
+    for (auto& s : corpus.correct_act_sent) oracle.push_back(s.second);
+    budget.init_actions(corpus.actions, oracle);
+    cerr << "Parse budget: " << budget.max_ms << " ms, " << budget.max_transitions
+         << " transitions (completion uses " << corpus.actions[budget.right_action]
+         << " / " << corpus.actions[budget.root_action] << ")\n";
+  }
+
   Model model;
-  ParserBuilder parser(&model, pretrained);
-  if (conf.count("model")) {
-    ifstream in(conf["model"].as<string>().c_str());
-    boost::archive::text_iarchive ia(in);
-    ia >> model;
+  // a saved decoder replaces the cnn model altogether, so that a quantized
+  // decoder does not also pay for the float32 parameters
+  unique_ptr<ParserBuilder> builder;
+  unique_ptr<GreedyDecoder> loaded_decoder;
+  if (conf.count("load_decoder")) {
+    if (conf.count("train")) {
+      cerr << "--load_decoder cannot be combined with --train\n";
+      abort();
+    }
+    const string& decoder_fname = conf["load_decoder"].as<string>();
+    ifstream in(decoder_fname.c_str(), ios_base::in | ios_base::binary);
+    loaded_decoder.reset(new GreedyDecoder(in, pretrained, &ParserBuilder::IsActionForbidden));
+    if (!in) {
+      cerr << "Could not read a decoder from " << decoder_fname << endl;
+      abort();
+    }
+    cerr << "Loaded decoder from " << decoder_fname << " (" << loaded_decoder->bytes() << " bytes)\n";
+  } else {
+    builder.reset(new ParserBuilder(&model, pretrained));
+    if (conf.count("model")) {
+      PROFILE_SCOPE(PROFILE_LOAD);
+      ifstream in(conf["model"].as<string>().c_str());
+      boost::archive::text_iarchive ia(in);
+      ia >> model;
+    }
+  }
+  // knowledge distillation: the teacher's distributions along the oracle of
+  // every training sentence, computed once and cached on disk. The teacher
+  // is built here, while the pretrained vectors are still around.
+  vector<SoftTargets> teacher_targets;
+  Distillation distill;
+  if (conf.count("teacher_model") && conf.count("train")) {
+    const string& teacher_fname = conf["teacher_model"].as<string>();
+    const string cache_fname = conf.count("teacher_cache") ? conf["teacher_cache"].as<string>() : teacher_fname + ".targets";
+    distill.topk = min(255u, max(1u, conf["distill_topk"].as<unsigned>()));
+    distill.weight = conf["distill_weight"].as<double>();
+    distill.temperature = conf["distill_temperature"].as<double>();
+    unsigned dims[7];  // in the order of the model file names
+    const string dims_spec = conf.count("teacher_dims") ? conf["teacher_dims"].as<string>() : teacher_fname;
+    const size_t name = dims_spec.find("parser_");
+    const char* p = dims_spec.c_str() + (name == string::npos ? 0 : dims_spec.find('_', name + 7) + 1);
+    if ((conf.count("teacher_dims") ? sscanf(p, "%u,%u,%u,%u,%u,%u,%u", &dims[0], &dims[1], &dims[2], &dims[3], &dims[4], &dims[5], &dims[6])
+                                    : sscanf(p, "%u_%u_%u_%u_%u_%u_%u", &dims[0], &dims[1], &dims[2], &dims[3], &dims[4], &dims[5], &dims[6])) != 7) {
+      cerr << "Could not get the teacher's dims from " << dims_spec << "; use --teacher_dims\n";
+      abort();
+    }
+    // identifies the cache: teacher file, dims, top k, the vocabularies (words,
+    // POS tags, pretrained words, OOV buckets) and the training data
+    struct stat st;
+    if (stat(teacher_fname.c_str(), &st) != 0) {
+      cerr << "Could not read the teacher model " << teacher_fname << endl;
+      abort();
+    }
+    uint64_t fingerprint = 14695981039346656037ull;
+    auto mix = [&](uint64_t x) { fingerprint = (fingerprint ^ x) * 1099511628211ull; };
+    auto mix_string = [&](const string& s) {
+      mix(s.size());
+      for (unsigned char c : s) mix(c);
+    };
+    mix(st.st_size); mix(st.st_mtime); mix(distill.topk);
+    for (unsigned d : dims) mix(d);
+    mix(USE_POS); mix(OOV_BUCKETS); mix(PRETRAINED_DIM);
+    for (auto& w : corpus.intToWords) { mix(w.first); mix_string(w.second); }
+    for (auto& t : corpus.intToPos) { mix(t.first); mix_string(t.second); }
+    vector<unsigned> pretrained_words;
+    for (auto& v : pretrained) pretrained_words.push_back(v.first);
+    sort(pretrained_words.begin(), pretrained_words.end());
+    for (unsigned w : pretrained_words) mix(w);
+    for (auto& s : corpus.sentences)
+      for (unsigned w : s.second) mix(w);
+    for (auto& s : corpus.sentencesPos)
+      for (unsigned t : s.second) mix(t);
+    for (auto& s : corpus.correct_act_sent)
+      for (unsigned a : s.second) mix(a);
+    if (load_soft_targets(cache_fname, fingerprint, &teacher_targets) && teacher_targets.size() == corpus.nsentences) {
+      cerr << "Loaded the teacher's distributions from " << cache_fname << endl;
+    } else {
+      unsigned* globals[7] = {&LAYERS, &INPUT_DIM, &HIDDEN_DIM, &ACTION_DIM, &LSTM_INPUT_DIM, &POS_DIM, &REL_DIM};
+      unsigned student[7];
+      for (unsigned i = 0; i < 7; ++i) { student[i] = *globals[i]; *globals[i] = dims[i]; }
+      Model teacher_model;
+      ParserBuilder teacher(&teacher_model, pretrained);
+      for (unsigned i = 0; i < 7; ++i) *globals[i] = student[i];
+      {
+        ifstream in(teacher_fname.c_str());
+        boost::archive::text_iarchive ia(in);
+        ia >> teacher_model;
+      }
+      cerr << "Computing the teacher's distributions on " << corpus.nsentences << " training sentences...";
+      auto t_start = std::chrono::steady_clock::now();
+      teacher_targets.assign(corpus.nsentences, SoftTargets());
+      Distillation record = distill;
+      for (unsigned sii = 0; sii < corpus.nsentences; ++sii) {
+        const vector<unsigned>& sentence=corpus.sentences[sii];  // no UNK replacement for the teacher
+        record.record = &teacher_targets[sii];
+        double right = 0;
+        ComputationGraph& hg = new_sentence_graph();
+        teacher.log_prob_parser(&hg,sentence,sentence,corpus.sentencesPos[sii],corpus.correct_act_sent[sii],
+                                corpus.actions,corpus.intToWords,&right,nullptr,nullptr,&record);
+      }
+      cerr << " done in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count() << " s\n";
+      if (save_soft_targets(cache_fname, fingerprint, teacher_targets))
+        cerr << "Cached them in " << cache_fname << endl;
+      else
+        cerr << "Could not write " << cache_fname << endl;
+    }
+    cerr << "Distillation from " << teacher_fname << ": weight " << distill.weight << ", temperature "
+         << distill.temperature << ", top " << distill.topk << " actions\n";
+  }
+
+  // the model (or the decoder) has its own copy of the pretrained vectors
+  release_pretrained_vectors();
+  ParserBuilder* parser = builder.get();
+  // replaces the state and composition matrices of the model by their
+  // compressed approximation, so that training fine-tunes the compressed
+  // model and saved models keep its structure
+  auto compress_model = [&]() {
+    for (Parameters* p : {parser->p_S, parser->p_B, parser->p_A, parser->p_H, parser->p_D}) {
+      Eigen::Map<Mat> w(p->values.v, p->values.d.rows(), p->values.d.cols());
+      w = approximate(w, compress_spec);
+    }
+  };
+  if (parser && compress_spec.type != FLOAT32) {
+    cerr << "Compressing the state and composition matrices: " << compress_spec.str() << endl;
+    compress_model();
+  }
+  // bumped whenever the parameters change, so that the parse cache never
+  // returns the output of an older model
+  uint64_t model_version = 1;
+  unique_ptr<ParseCache> parse_cache;
+  // peak size of the computation graphs, by sentence length. Walking every
+  // graph costs time on each sentence, so they are only measured with
+  // --memory_report.
+  const bool memory_report = conf.count("memory_report");
+  GraphMemory graph_memory;
+  if (conf["parse_cache"].as<unsigned>() > 0) {
+    parse_cache.reset(new ParseCache(conf["parse_cache"].as<unsigned>()));
+    cerr << "Parse cache: " << parse_cache->capacity << " sentences\n";
   }
 
+  // set while parsing the -p data with --record_trace
+  unique_ptr<TraceWriter> trace;
+  std::mutex trace_mutex;
+  auto record = [&](TraceWriter::Clock::time_point arrival, const vector<unsigned>& sentence,
+                    const vector<unsigned>& sentencePos, const vector<string>& sentenceUnkStr) {
+    const TraceWriter::Clock::time_point done = TraceWriter::Clock::now();
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace->add(arrival, done, sentence.size(),
+               [&](unsigned i) -> const string& {
+                 return sentenceUnkStr[i].empty() ? corpus.intToWords.find(sentence[i])->second : sentenceUnkStr[i];
+               },
+               [&](unsigned i) -> string {
+                 auto it = corpus.intToPos.find(sentencePos[i]);
+                 return it == corpus.intToPos.end() ? string() : it->second;
+               });
+  };
+
+  // decodes a sentence with the graph parser, or with the graphless decoder
+  // when one is given, going through the parse cache when it is enabled.
+  // With a decoder it can be called from several threads (ParseCache locks
+  // itself).
+  auto decode = [&](const GreedyDecoder* decoder, const ParseBudget* budget,
+                    const vector<unsigned>& sentence, const vector<unsigned>& tsentence,
+                    const vector<unsigned>& sentencePos, const vector<string>& sentenceUnkStr,
+                    double* right, DecodeStats* stats) -> vector<unsigned> {
+    const TraceWriter::Clock::time_point arrival = TraceWriter::Clock::now();
+    ParseCache::Key key;
+    if (parse_cache) {
+      key.words = sentence;
+      key.pos = sentencePos;
+      key.oov = sentenceUnkStr;
+      ParseCache::Value value;
+      if (parse_cache->lookup(key, model_version, &value)) {
+        stats->transitions = value.actions.size();
+        stats->degraded = false;  // degraded parses are never cached
+        if (trace) record(arrival, sentence, sentencePos, sentenceUnkStr);
+        return value.actions;
+      }
+    }
+    vector<unsigned> pred;
+    PROFILE_TIMER(parse_timer);
+    if (decoder) {
+      pred = decoder->parse(sentence,tsentence,sentencePos,corpus.actions,possible_actions,budget,stats);
+    } else {
+      ComputationGraph& cg = new_sentence_graph();
+      pred = parser->log_prob_parser(&cg,sentence,tsentence,sentencePos,vector<unsigned>(),corpus.actions,corpus.intToWords,right,budget,stats);
+      if (memory_report) graph_memory.add(sentence.size() - 1, cg, false);
+    }
+    PROFILE_SENTENCE(parse_timer, sentence.size() - 1, stats->transitions);
+    // degraded parses depend on timing, so they are not worth keeping
+    if (parse_cache && !stats->degraded) parse_cache->insert(key, model_version, ParseCache::Value{pred});
+    if (trace) record(arrival, sentence, sentencePos, sentenceUnkStr);
+    return pred;
+  };
+
   // OOV words will be replaced by UNK tokens
-  corpus.load_correct_actionsDev(conf["dev_data"].as<string>());
+  {
+    PROFILE_SCOPE(PROFILE_LOAD);
+    corpus.frozen = conf.count("frozen_vocab");
+    corpus.load_correct_actionsDev(conf["dev_data"].as<string>());
+  }
+  // the POS tag of a development token as written in the input
+  auto pos_string = [&](unsigned sii, unsigned i) -> const string& {
+    const string& unseen = corpus.sentencesPosStrDev[sii][i];
+    return unseen.empty() ? corpus.intToPos[corpus.sentencesPosDev[sii][i]] : unseen;
+  };
+
+  // gold trees of the development data, and the tokens left out of the
+  // scores without punctuation, computed once for all evaluations
+  const ActionTable action_table(corpus.actions);
+  set<string> punct_tags;
+  if (conf.count("punct_tags")) {
+    istringstream in(conf["punct_tags"].as<string>());
+    string tag;
+    while (in >> tag) punct_tags.insert(tag);
+  }
+  vector<vector<int>> gold_heads(corpus.nsentencesDev), gold_rels(corpus.nsentencesDev);
+  vector<vector<bool>> gold_punct(corpus.nsentencesDev);
+  for (unsigned sii = 0; sii < corpus.nsentencesDev; ++sii) {
+    const vector<unsigned>& sentence=corpus.sentencesDev[sii];
+    compute_heads(sentence.size(), corpus.correct_act_sentDev[sii], action_table, &gold_heads[sii], &gold_rels[sii]);
+    vector<bool>& punct = gold_punct[sii];
+    punct.resize(sentence.size() - 1);
+    for (unsigned i = 0; i + 1 < sentence.size(); ++i) {
+      if (!punct_tags.empty()) {
+        punct[i] = punct_tags.count(pos_string(sii, i));
+      } else {
+        const string& unk = corpus.sentencesStrDev[sii][i];
+        punct[i] = is_punctuation(unk.empty() ? corpus.intToWords[sentence[i]] : unk);
+      }
+    }
+  }
+  // adds the parse of a development sentence to an evaluation
+  vector<int> hyp_heads, hyp_rels;
+  auto evaluate = [&](unsigned sii, const vector<unsigned>& pred, Evaluation* eval) {
+    compute_heads(corpus.sentencesDev[sii].size(), pred, action_table, &hyp_heads, &hyp_rels);
+    eval->add(gold_heads[sii], gold_rels[sii], hyp_heads, hyp_rels, gold_punct[sii]);
+  };
+
+  auto print_memory_report = [&](const GreedyDecoder* decoder) {
+    MemoryReport report;
+    if (parser) add_model_memory(*parser, training_vocab.size() + 1, &report);
+    if (decoder) report.add("model", "graphless decoder", decoder->bytes());
+    add_corpus_memory(parser, &report);
+    report.print(cerr);
+    graph_memory.print(cerr);
+  };
+  signal(SIGUSR2, memory_report_handler);
+  if (memory_report) print_memory_report(loaded_decoder.get());
+
+  // the words of a development sentence as the model sees them: the words
+  // outside the training vocabulary go to UNK, or to their OOV bucket. Only
+  // reads the corpus, so it can be called from several threads.
+  auto model_words = [&](const vector<unsigned>& sentence, const vector<string>& sentenceUnkStr) {
+    vector<unsigned> tsentence=sentence;
+    for (unsigned i = 0; i < tsentence.size(); ++i) {
+      unsigned& w = tsentence[i];
+      if (training_vocab.count(w)) continue;
+      w = sentenceUnkStr[i].empty() ? oov_bucket(corpus.intToWords.find(w)->second, kUNK)
+                                    : oov_bucket(sentenceUnkStr[i], kUNK);
+    }
+    return tsentence;
+  };
+
+  // unlabeled and labeled attachment scores of a graphless decoder on the
+  // development data, with the time it took
+  struct DecoderScore { double uas, las, ms; };
+  auto score_decoder = [&](const GreedyDecoder& decoder) -> DecoderScore {
+    Evaluation eval;
+    auto t_start = std::chrono::high_resolution_clock::now();
+    for (unsigned sii = 0; sii < corpus.nsentencesDev; ++sii) {
+      const vector<unsigned>& sentence=corpus.sentencesDev[sii];
+      const vector<unsigned> tsentence = model_words(sentence, corpus.sentencesStrDev[sii]);
+      vector<unsigned> pred = decoder.parse(sentence,tsentence,corpus.sentencesPosDev[sii],corpus.actions,possible_actions);
+      evaluate(sii, pred, &eval);
+    }
+    auto t_end = std::chrono::high_resolution_clock::now();
+    return DecoderScore{eval.uas(), eval.las(),
+                        std::chrono::duration<double, std::milli>(t_end-t_start).count()};
+  };
   //TRAINING
   if (conf.count("train")) {
     signal(SIGINT, signal_callback_handler);
-    SimpleSGDTrainer sgd(&model);
-    //MomentumSGDTrainer sgd(&model);
-    sgd.eta_decay = 0.08;
-    //sgd.eta_decay = 0.05;
+    signal(SIGTERM, signal_callback_handler);  // preemption
+    unique_ptr<TrainingMetrics> metrics;
+    if (conf.count("metrics_file")) {
+      const string& format = conf["metrics_format"].as<string>();
+      if (format != "prometheus" && format != "jsonl") {
+        cerr << "Unknown --metrics_format: " << format << endl;
+        abort();
+      }
+      metrics.reset(new TrainingMetrics(conf["metrics_file"].as<string>(), format == "jsonl",
+                                        conf["metrics_every"].as<double>()));
+      metrics->maxit = maxit;
+      signal(SIGUSR1, metrics_handler);
+      cerr << "Writing training metrics to " << conf["metrics_file"].as<string>() << endl;
+    }
+    SparseTrainer::Rule rule;
+    if (!SparseTrainer::parse_rule(conf["optimizer"].as<string>(), &rule)) {
+      cerr << "Unknown --optimizer: " << conf["optimizer"].as<string>() << endl;
+      abort();
+    }
+    LRSchedule lr_schedule;
+    if (!LRSchedule::parse(conf["lr_schedule"].as<string>(), &lr_schedule)) {
+      cerr << "Bad --lr_schedule specification: " << conf["lr_schedule"].as<string>() << endl;
+      abort();
+    }
+    lr_schedule.warmup = conf["lr_warmup"].as<double>();
+    const float eta0 = conf.count("eta0") ? conf["eta0"].as<double>() : SparseTrainer::default_eta0(rule);
+    SparseTrainer sgd(&model, rule, 1e-6, eta0, {parser->p_t});  // the pretrained embeddings stay as read
+    cerr << "Optimizer: " << SparseTrainer::rule_name(rule) << ", eta0 " << eta0 << ", schedule "
+         << lr_schedule.str() << ", warmup " << lr_schedule.warmup << " epochs" << endl;
+    const double target_uas = conf.count("target_uas") ? conf["target_uas"].as<double>() : -1;
+    DevSchedule dev_schedule;
+    if (!DevSchedule::parse(conf["dev_every"].as<string>(), &dev_schedule)) {
+      cerr << "Bad --dev_every specification: " << conf["dev_every"].as<string>() << endl;
+      abort();
+    }
+    // the dev sentences scored at each evaluation, and all of them
+    vector<unsigned> dev_lengths(corpus.nsentencesDev);
+    for (unsigned sii = 0; sii < corpus.nsentencesDev; ++sii) dev_lengths[sii] = corpus.sentencesDev[sii].size();
+    const vector<unsigned> all_dev = stratified_dev_sample(dev_lengths, 0);
+    const vector<unsigned> dev_sample = stratified_dev_sample(dev_lengths, conf["dev_subsample"].as<unsigned>());
+    const bool dev_sampled = dev_sample.size() < all_dev.size();
+    EarlyStopping early_stopping(conf["patience"].as<unsigned>(), conf["patience_window"].as<unsigned>(), tolerance);
+    cerr << "Dev evaluation: " << dev_schedule.str() << ", on " << dev_sample.size() << " of " << all_dev.size()
+         << " sentences";
+    if (early_stopping.patience)
+      cerr << ", patience " << early_stopping.patience << " over a window of " << early_stopping.window;
+    cerr << endl;
+    bool target_reached = false;
+    double train_seconds = 0;  // before this run, when resuming
     vector<unsigned> order(corpus.nsentences);
     for (unsigned i = 0; i < corpus.nsentences; ++i)
       order[i] = i;
@@ -633,79 +733,218 @@ int main(int argc, char** argv) {
     unsigned iter = 0;
     double uas = -1;
     double prev_uas = -1;
+    unsigned logc = 0;
+    string checkpoint_fname;
+    if (conf.count("checkpoint")) checkpoint_fname = conf["checkpoint"].as<string>();
+    else if (conf.count("resume")) checkpoint_fname = conf["resume"].as<string>();
+    if (conf.count("resume")) {
+      TrainingState state;
+      if (!load_checkpoint(conf["resume"].as<string>(), &state, &model)) {
+        cerr << "Could not read a checkpoint from " << conf["resume"].as<string>() << endl;
+        abort();
+      }
+      if (state.order.size() != corpus.nsentences) {
+        cerr << "The checkpoint was written for a training corpus of " << state.order.size() << " sentences\n";
+        abort();
+      }
+      if (state.optimizer != SparseTrainer::rule_name(rule)) {
+        cerr << "The checkpoint was written with --optimizer " << state.optimizer << endl;
+        abort();
+      }
+      state.restore_trainer(&sgd);
+      sgd.restore_state(state.optimizer_state, state.optimizer_steps);
+      lr_schedule.plateau_factor = state.plateau_factor;
+      lr_schedule.best_uas = state.best_uas;
+      lr_schedule.bad_evals = state.bad_evals;
+      train_seconds = state.train_seconds;
+      target_reached = state.target_reached;
+      dev_schedule.last_sentences = state.dev_last_sentences;
+      dev_schedule.last_seconds = state.dev_last_seconds;
+      dev_schedule.best_sample_uas = state.dev_best_sample_uas;
+      early_stopping.recent = state.stop_recent;
+      early_stopping.best_avg = state.stop_best_avg;
+      early_stopping.bad_evals = state.stop_bad_evals;
+      state.restore_rng();
+      order = state.order;
+      si = state.si;
+      iter = state.iter;
+      logc = state.logc;
+      first = state.first;
+      tot_seen = state.tot_seen;
+      best_correct_heads = state.best_correct_heads;
+      uas = state.uas;
+      prev_uas = state.prev_uas;
+      fname = state.params_fname;
+      ++model_version;
+      if (metrics) metrics->iter = metrics->start_iter = iter;
+      cerr << "Resumed training from " << conf["resume"].as<string>() << " at update #" << iter
+           << " (epoch " << (tot_seen / corpus.nsentences) << ", eta " << sgd.eta
+           << "); the best model is still written to " << fname << endl;
+    }
+    const auto train_start = std::chrono::steady_clock::now();
+    auto elapsed_seconds = [&]() {
+      return train_seconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - train_start).count();
+    };
+    auto write_checkpoint = [&]() {
+      sgd.flush();
+      TrainingState state;
+      state.params_fname = fname;
+      state.save_trainer(sgd);
+      state.optimizer = SparseTrainer::rule_name(rule);
+      sgd.save_state(&state.optimizer_state, &state.optimizer_steps);
+      state.plateau_factor = lr_schedule.plateau_factor;
+      state.best_uas = lr_schedule.best_uas;
+      state.bad_evals = lr_schedule.bad_evals;
+      state.train_seconds = elapsed_seconds();
+      state.target_reached = target_reached;
+      state.dev_last_sentences = dev_schedule.last_sentences;
+      state.dev_last_seconds = dev_schedule.last_seconds;
+      state.dev_best_sample_uas = dev_schedule.best_sample_uas;
+      state.stop_recent = early_stopping.recent;
+      state.stop_best_avg = early_stopping.best_avg;
+      state.stop_bad_evals = early_stopping.bad_evals;
+      state.save_rng();
+      state.order = order;
+      state.si = si;
+      state.iter = iter;
+      state.logc = logc;
+      state.first = first;
+      state.tot_seen = tot_seen;
+      state.best_correct_heads = best_correct_heads;
+      state.uas = uas;
+      state.prev_uas = prev_uas;
+      if (save_checkpoint(checkpoint_fname, state, model))
+        cerr << "Wrote checkpoint " << checkpoint_fname << " at update #" << iter << endl;
+      else
+        cerr << "Could not write checkpoint " << checkpoint_fname << endl;
+    };
+    auto last_checkpoint = train_start;
+    const double checkpoint_every = conf["checkpoint_every"].as<double>();
     time_t time_start = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
     cerr << "TRAINING STARTED AT: " << put_time(localtime(&time_start), "%c %Z") << endl;
     while(!requested_stop && iter < maxit &&
-        (tolerance < 0 || uas < 0 || prev_uas < 0 || abs(prev_uas - uas) > tolerance)) {
+        (early_stopping.patience ? !early_stopping.stop()
+                                 : tolerance < 0 || uas < 0 || prev_uas < 0 || abs(prev_uas - uas) > tolerance)) {
       for (unsigned sii = 0; sii < status_every_i_iterations; ++sii) {
            if (si == corpus.nsentences) {
              si = 0;
+             if (metrics) metrics->new_epoch(first);
              if (first) { first = false; } else { sgd.update_epoch(); }
              cerr << "**SHUFFLE\n";
-             random_shuffle(order.begin(), order.end());
+             shuffle(order.begin(), order.end(), *cnn::rndeng);
            }
+           sgd.eta = lr_schedule.rate(sgd.eta0, tot_seen / corpus.nsentences);
            tot_seen += 1;
            const vector<unsigned>& sentence=corpus.sentences[order[si]];
            vector<unsigned> tsentence=sentence;
            if (unk_strategy == 1) {
              for (auto& w : tsentence)
-               if (singletons.count(w) && cnn::rand01() < unk_prob) w = kUNK;
+               if (singletons.count(w) && cnn::rand01() < unk_prob) w = oov_bucket(corpus.intToWords[w], kUNK);
            }
            const vector<unsigned>& sentencePos=corpus.sentencesPos[order[si]];
            const vector<unsigned>& actions=corpus.correct_act_sent[order[si]];
-           ComputationGraph hg;
-           parser.log_prob_parser(&hg,sentence,tsentence,sentencePos,actions,corpus.actions,corpus.intToWords,&right);
+           ComputationGraph& hg = new_sentence_graph();
+           distill.targets = teacher_targets.empty() ? nullptr : &teacher_targets[order[si]];
+           parser->log_prob_parser(&hg,sentence,tsentence,sentencePos,actions,corpus.actions,corpus.intToWords,&right,
+                                   nullptr,nullptr,distill.targets ? &distill : nullptr);
+           PROFILE_TIMER(step_timer);
            double lp = as_scalar(hg.incremental_forward());
+           PROFILE_LAP(step_timer, PROFILE_FORWARD);
            if (lp < 0) {
              cerr << "Log prob < 0 on sentence " << order[si] << ": lp=" << lp << endl;
              assert(lp >= 0.0);
            }
            hg.backward();
+           PROFILE_LAP(step_timer, PROFILE_BACKWARD);
+           if (memory_report) graph_memory.add(sentence.size() - 1, hg, true);
            sgd.update(1.0);
+           PROFILE_LAP(step_timer, PROFILE_UPDATE);
+           ++model_version;
            llh += lp;
            ++si;
            trs += actions.size();
+           if (metrics && (metrics_requested || metrics->due())) {
+             metrics_requested = 0;
+             metrics->write();
+           }
+      }
+      if (compress_spec.type != FLOAT32) {  // project back after the updates
+        compress_model();
+        ++model_version;
       }
       sgd.status();
+      if (memory_report_requested) {
+        memory_report_requested = 0;
+        print_memory_report(nullptr);
+      }
       time_t time_now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
       cerr << "update #" << iter << " (epoch " << (tot_seen / corpus.nsentences) << " |time=" << put_time(localtime(&time_now), "%c %Z") << ")\tllh: "<< llh<<" ppl: " << exp(llh / trs) << " err: " << (trs - right) / trs << endl;
+      if (metrics) {
+        metrics->end_block(status_every_i_iterations, trs, llh, right);
+        metrics->epoch = tot_seen / corpus.nsentences;
+      }
       llh = trs = right = 0;
 
-      static int logc = 0;
       ++logc;
-      if (logc % 25 == 1) { // report on dev set
-        unsigned dev_size = corpus.nsentencesDev;
-        // dev_size = 100;
-        double llh = 0;
-        double trs = 0;
-        double right = 0;
-        double correct_heads = 0;
-        double total_heads = 0;
-        auto t_start = std::chrono::high_resolution_clock::now();
-        for (unsigned sii = 0; sii < dev_size; ++sii) {
-           const vector<unsigned>& sentence=corpus.sentencesDev[sii];
-           const vector<unsigned>& sentencePos=corpus.sentencesPosDev[sii];
-           const vector<unsigned>& actions=corpus.correct_act_sentDev[sii];
-           vector<unsigned> tsentence=sentence;
-           for (auto& w : tsentence)
-             if (training_vocab.count(w) == 0) w = kUNK;
+      if (dev_schedule.due(logc, tot_seen, elapsed_seconds())) { // report on dev set
+        sgd.flush();
+        dev_schedule.evaluated(tot_seen, elapsed_seconds());
+        unique_ptr<GreedyDecoder> decoder;
+        if (bounded_memory) decoder.reset(new GreedyDecoder(*parser, pretrained));
+        // scores and reports the given development sentences, returns the time in ms
+        auto score_dev = [&](const vector<unsigned>& dev_sentences, const char* what, Evaluation* eval) {
+          double llh = 0;
+          double trs = 0;
+          double right = 0;
+          auto t_start = std::chrono::high_resolution_clock::now();
+          for (unsigned sii : dev_sentences) {
+             const vector<unsigned>& sentence=corpus.sentencesDev[sii];
+             const vector<unsigned>& sentencePos=corpus.sentencesPosDev[sii];
+             const vector<unsigned>& actions=corpus.correct_act_sentDev[sii];
+             const vector<unsigned> tsentence = model_words(sentence, corpus.sentencesStrDev[sii]);
 
-           ComputationGraph hg;
-           vector<unsigned> pred = parser.log_prob_parser(&hg,sentence,tsentence,sentencePos,vector<unsigned>(),corpus.actions,corpus.intToWords,&right);
-           double lp = 0;
-           llh -= lp;
-           trs += actions.size();
-           map<int,int> ref = parser.compute_heads(sentence.size(), actions, corpus.actions);
-           map<int,int> hyp = parser.compute_heads(sentence.size(), pred, corpus.actions);
-           //output_conll(sentence, corpus.intToWords, ref, hyp);
-           correct_heads += compute_correct(ref, hyp, sentence.size() - 1);
-           total_heads += sentence.size() - 1;
-        }
-        auto t_end = std::chrono::high_resolution_clock::now();
+             DecodeStats stats;
+             vector<unsigned> pred = decode(decoder.get(), nullptr, sentence, tsentence, sentencePos,
+                                            corpus.sentencesStrDev[sii], &right, &stats);
+             double lp = 0;
+             llh -= lp;
+             trs += actions.size();
+             PROFILE_TIMER(eval_timer);
+             evaluate(sii, pred, eval);
+             PROFILE_LAP(eval_timer, PROFILE_COMPUTE_HEADS);
+          }
+          auto t_end = std::chrono::high_resolution_clock::now();
+          const double ms = std::chrono::duration<double, std::milli>(t_end-t_start).count();
+          cerr << "  **" << what << " (iter=" << iter << " epoch=" << (tot_seen / corpus.nsentences) << ")\tllh=" << llh << " ppl: " << exp(llh / trs) << " err: " << (trs - right) / trs << " uas: " << eval->uas() << "\t[" << dev_sentences.size() << " sents in " << ms << " ms]" << endl;
+          return ms;
+        };
+        Evaluation eval;
+        double dev_ms = score_dev(dev_sample, dev_sampled ? "dev sample" : "dev", &eval);
+        // the schedules, early stopping and --tolerance only see the score
+        // on the fixed sample, which is comparable from one evaluation to
+        // the next
         prev_uas = uas;
-        uas = correct_heads / total_heads;
-        cerr << "  **dev (iter=" << iter << " epoch=" << (tot_seen / corpus.nsentences) << ")\tllh=" << llh << " ppl: " << exp(llh / trs) << " err: " << (trs - right) / trs << " uas: " << uas << "\t[" << dev_size << " sents in " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << " ms]" << endl;
-        if (correct_heads > best_correct_heads) {
+        uas = eval.uas();
+        lr_schedule.dev_score(uas);
+        early_stopping.add(uas);
+        // the whole dev set, when the sample may have found a better model
+        const bool confirm = dev_sampled && dev_schedule.likely_new_best(uas, eval.tokens());
+        if (dev_sampled) dev_schedule.sample_score(uas);
+        if (confirm) {
+          eval = Evaluation();
+          dev_ms += score_dev(all_dev, "dev", &eval);
+        }
+        if (metrics) metrics->add_dev(eval.uas(), dev_ms / 1000);
+        // the target and the best model are judged on the whole dev set
+        const bool full = !dev_sampled || confirm;
+        const int correct_heads = eval.correct_heads();
+        if (full && target_uas >= 0 && !target_reached && eval.uas() >= target_uas) {
+          target_reached = true;
+          cerr << "  **reached target dev uas " << target_uas << " after " << elapsed_seconds() << " s of training, "
+               << tot_seen << " sentences (update #" << iter << ", epoch " << (tot_seen / corpus.nsentences)
+               << ") with " << SparseTrainer::rule_name(rule) << " and " << lr_schedule.str() << endl;
+        }
+        if (full && correct_heads > best_correct_heads) {
           best_correct_heads = correct_heads;
           ofstream out(fname);
           boost::archive::text_oarchive oa(out);
@@ -724,9 +963,25 @@ int main(int argc, char** argv) {
         }
       }
       ++iter;
+      if (metrics) metrics->iter = iter;
+      if (!checkpoint_fname.empty() &&
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - last_checkpoint).count() >= 60 * checkpoint_every) {
+        write_checkpoint();
+        last_checkpoint = std::chrono::steady_clock::now();
+      }
     }
+    sgd.flush();  // the test evaluation below uses the model as trained
+    ++model_version;  // the flush decayed the embeddings
+    if (!checkpoint_fname.empty()) write_checkpoint();
+    if (target_uas >= 0 && !target_reached)
+      cerr << "Target dev uas " << target_uas << " not reached after " << elapsed_seconds() << " s of training, "
+           << tot_seen << " sentences" << endl;
+    if (metrics) metrics->write();
     if (iter >= maxit) {
       cerr << "\nMaximum number of iterations reached (" << iter << "), terminating optimization...\n";
+    } else if (early_stopping.stop()) {
+      cerr << "\nNo dev improvement over " << early_stopping.patience << " evaluations (window of "
+           << early_stopping.window << ", tolerance " << early_stopping.min_delta << "), terminating optimization...\n";
     } else if (!requested_stop) {
       cerr << "\nScore tolerance reached (" << tolerance << "), terminating optimization...\n";
     }
@@ -735,36 +990,350 @@ int main(int argc, char** argv) {
     double llh = 0;
     double trs = 0;
     double right = 0;
-    double correct_heads_unlabeled = 0;
-    double correct_heads_labeled = 0;
-    double total_heads = 0;
+    Evaluation eval;
     auto t_start = std::chrono::high_resolution_clock::now();
+#ifdef COUNT_ALLOCATIONS
+    const unsigned long allocations_start = heap_allocations;
+#endif
     unsigned corpus_size = corpus.nsentencesDev;
+    if (parser && !compress_candidates.empty()) {
+      cerr << "Compression candidates on " << corpus.nsentencesDev << " sentences:\n";
+      CompressionSpec none;
+      compress_candidates.insert(compress_candidates.begin(), none);
+      for (auto& spec : compress_candidates) {
+        GreedyDecoder candidate(*parser, pretrained);
+        candidate.compress(spec);
+        const DecoderScore score = score_decoder(candidate);
+        size_t bytes = 0;
+        for (const QuantizedMatrix* m : {&candidate.S, &candidate.B, &candidate.A, &candidate.H, &candidate.D})
+          bytes += m->bytes();
+        cerr << "  " << spec.str() << "\tuas: " << score.uas << " las: " << score.las
+             << "\t" << score.ms / corpus.nsentencesDev << " ms/sentence\t" << bytes << " bytes in S, B, A, H, D" << endl;
+      }
+    }
+    unique_ptr<GreedyDecoder> decoder(std::move(loaded_decoder));
+    if (!decoder && bounded_memory) decoder.reset(new GreedyDecoder(*parser, pretrained));
+    if (parser && compress_spec.type != FLOAT32) decoder->compress(compress_spec);
+    if (quantize != FLOAT32) {
+      // report what quantization costs on this data before using it
+      const DecoderScore before = score_decoder(*decoder);
+      const size_t bytes_before = decoder->bytes();
+      decoder->quantize(quantize);
+      const DecoderScore after = score_decoder(*decoder);
+      cerr << "Quantization to " << weight_type_name(quantize) << ":\n"
+           << "  float32 uas: " << before.uas << " las: " << before.las << " [" << before.ms << " ms, "
+           << bytes_before << " bytes + lookup tables read from the model]\n"
+           << "  " << weight_type_name(quantize) << " uas: " << after.uas << " las: " << after.las
+           << " [" << after.ms << " ms, " << decoder->bytes() << " bytes]\n"
+           << "  delta uas: " << (after.uas - before.uas) << " las: " << (after.las - before.las) << endl;
+    }
+    // the parses cached by the dev evaluations came from other weights than
+    // the compressed or quantized decoder's
+    ++model_version;
+    if (conf.count("save_decoder")) {
+      const string& decoder_fname = conf["save_decoder"].as<string>();
+      ofstream out(decoder_fname.c_str(), ios_base::out | ios_base::binary);
+      decoder->write(out);
+      cerr << "Wrote decoder to " << decoder_fname << " (" << decoder->bytes() << " bytes)" << endl;
+    }
+    // NUMA placement for --threads: a copy of the decoder per node, built by
+    // a thread pinned to that node so that its pages are local to it, and
+    // the threads pinned round-robin over the nodes
+    NumaTopology topology;
+    vector<unique_ptr<GreedyDecoder>> replicas;  // by node
+    if (conf.count("numa") && nthreads > 1) {
+      topology.print(cerr);
+      replicas.resize(topology.nodes());
+      for (unsigned n = 0; n < topology.nodes(); ++n) {
+        std::thread([&, n]() {
+          topology.pin(n);  // thread n runs on node n
+          replicas[n].reset(new GreedyDecoder(*decoder));
+          replicas[n]->own_tables();  // the model's float32 tables live on node 0
+        }).join();
+      }
+      cerr << "Decoder replicas: " << replicas.size() << " x " << replicas[0]->bytes() << " bytes" << endl;
+    }
+    // the decoder of the calling thread
+    auto local_decoder = [&]() -> const GreedyDecoder* {
+      return replicas.empty() ? decoder.get() : replicas[max(0, current_numa_node())].get();
+    };
+    auto pin_thread = [&](unsigned t) { topology.pin(t); };
+
+    if (conf.count("replay_trace")) {
+      const string& trace_fname = conf["replay_trace"].as<string>();
+      vector<TraceRecord> records;
+      if (!read_trace(trace_fname, &records)) {
+        cerr << "Could not read a trace from " << trace_fname << endl;
+        abort();
+      }
+      // the trace's strings are mapped like the -d data, without adding to
+      // the vocabulary
+      TraceReplay replay(nthreads, conf["replay_speed"].as<double>());
+      if (!replicas.empty()) replay.thread_init = pin_thread;
+      replay.run(records, [&](const TraceRecord& r) {
+        vector<unsigned> sentence(r.words.size()), sentencePos(r.words.size());
+        vector<string> sentenceUnkStr(r.words.size());
+        for (unsigned i = 0; i < r.words.size(); ++i) {
+          auto w = corpus.wordsToInt.find(r.words[i]);
+          if (w != corpus.wordsToInt.end() && w->second) {
+            sentence[i] = w->second;
+          } else {
+            sentence[i] = kUNK;
+            sentenceUnkStr[i] = r.words[i];
+          }
+          auto p = corpus.posToInt.find(r.tags[i]);
+          sentencePos[i] = p == corpus.posToInt.end() ? 0 : p->second;
+        }
+        const vector<unsigned> tsentence = model_words(sentence, sentenceUnkStr);
+        DecodeStats stats;
+        double r_right = 0;
+        decode(local_decoder(), &budget, sentence, tsentence, sentencePos, sentenceUnkStr, &r_right, &stats);
+      });
+      cerr << "Replayed " << trace_fname << endl;
+      replay.report(cerr);
+      if (profiler.enabled)
+        profiler.report(cerr);
+      return 0;
+    }
+    if (conf.count("jobs")) {
+      const string& source = conf["jobs"].as<string>();
+      JobRunner jobs(source, conf["job_suffix"].as<string>(),
+                     conf.count("job_journal") ? conf["job_journal"].as<string>() : JobRunner::default_journal(source));
+      if (!jobs.load()) {
+        cerr << "Could not read the jobs of " << source << " or open their journal " << jobs.journal_fname << endl;
+        abort();
+      }
+      signal(SIGINT, signal_callback_handler);
+      signal(SIGTERM, signal_callback_handler);
+      // the files not done yet, the largest ones first
+      vector<unsigned> todo, lengths;
+      for (unsigned f = 0; f < jobs.files.size(); ++f) {
+        if (jobs.done[f]) continue;
+        todo.push_back(f);
+        lengths.push_back(JobRunner::kbytes(jobs.files[f]));
+      }
+      cerr << "Jobs: " << jobs.files.size() << " files in " << source << ", " << todo.size() << " to parse, journal "
+           << jobs.journal_fname << endl;
+      Evaluation job_eval;
+      std::mutex job_eval_mutex;
+      // each file is read, parsed and written by one thread, one sentence at
+      // a time; the inputs are read without changing the vocabulary
+      ParseScheduler scheduler(nthreads, schedule);
+      if (!replicas.empty()) scheduler.thread_init = pin_thread;
+      scheduler.run(lengths, [&](unsigned j) {
+        const string& file = jobs.files[todo[j]];
+        if (requested_stop) return;
+        const auto t_start = std::chrono::steady_clock::now();
+        ifstream in(file.c_str());
+        if (!in) {
+          cerr << "FAILED " << file << ": cannot read it" << endl;
+          jobs.failed(file);
+          return;
+        }
+        Evaluation file_eval;
+        unsigned sentences = 0, unscored = 0;
+        unsigned long tokens = 0;
+        vector<unsigned> degraded;  // sentence numbers, as CoNLL-X output cannot mark them
+        bool complete = true;
+        {
+          ParseWriter out(jobs.temp_of(file), output_format, action_table);
+          cpyp::Corpus::OracleSentence s;
+          vector<int> heads, rels, gold_h, gold_r;
+          while (corpus.read_sentence(in, &s)) {
+            if (requested_stop) { complete = false; break; }
+            const vector<unsigned> tsentence = model_words(s.words, s.words_str);
+            DecodeStats stats;
+            double r = 0;
+            vector<unsigned> pred = decode(local_decoder(), &budget, s.words, tsentence, s.pos, s.words_str, &r, &stats);
+            compute_heads(s.words.size(), pred, action_table, &heads, &rels);
+            auto form = [&](unsigned i) -> const string& {
+              return s.words_str[i].empty() ? corpus.intToWords.find(s.words[i])->second : s.words_str[i];
+            };
+            auto tag = [&](unsigned i) -> const string& {
+              static const string kNoTag = "_";  // a token written without a tag
+              if (!s.pos_str[i].empty()) return s.pos_str[i];
+              auto it = corpus.intToPos.find(s.pos[i]);
+              return it == corpus.intToPos.end() ? kNoTag : it->second;
+            };
+            if (s.unknown_actions) {  // an incomplete oracle gives no gold tree
+              ++unscored;
+            } else if (!s.actions.empty()) {  // gold actions: score the file
+              compute_heads(s.words.size(), s.actions, action_table, &gold_h, &gold_r);
+              vector<bool> punct(s.words.size() - 1);
+              for (unsigned i = 0; i < punct.size(); ++i)
+                punct[i] = punct_tags.empty() ? is_punctuation(form(i)) : punct_tags.count(tag(i));
+              file_eval.add(gold_h, gold_r, heads, rels, punct);
+            }
+            out.write(s.words.size() - 1, form, tag, heads, rels, stats.degraded);
+            if (stats.degraded) degraded.push_back(sentences);
+            ++sentences;
+            tokens += s.words.size() - 1;
+          }
+          complete = out.close() && complete;  // renamed and journaled only when complete
+        }
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+        if (!complete || !jobs.commit(file, sentences, tokens, ms)) {
+          if (!requested_stop) cerr << "FAILED " << file << ": cannot write " << jobs.output_of(file) << endl;
+          jobs.failed(file);
+          return;
+        }
+        std::lock_guard<std::mutex> lock(job_eval_mutex);
+        cerr << file << ": " << sentences << " sentences, " << tokens << " tokens in " << ms << " ms ("
+             << (ms > 0 ? 1000. * tokens / ms : 0) << " tokens/s)";
+        if (file_eval.tokens()) cerr << " uas: " << file_eval.uas() << " las: " << file_eval.las();
+        if (unscored) cerr << ", " << unscored << " sentences not scored (oracle actions unseen in training)";
+        if (!degraded.empty()) {
+          cerr << ", " << degraded.size() << " degraded (sentence";
+          for (unsigned d : degraded) cerr << ' ' << d;
+          cerr << ')';
+        }
+        cerr << endl;
+        job_eval.merge(file_eval);
+      });
+      jobs.report(cerr);
+      if (job_eval.tokens())
+        cerr << "Jobs with gold actions: uas: " << job_eval.uas() << " las: " << job_eval.las()
+             << " (without punctuation: uas: " << job_eval.uas_nopunct() << " las: " << job_eval.las_nopunct() << ")\n";
+      if (profiler.enabled)
+        profiler.report(cerr);
+      return requested_stop || jobs.files_failed ? 1 : 0;
+    }
+    if (conf.count("record_trace")) trace.reset(new TraceWriter(conf["record_trace"].as<string>()));
+    ParseWriter writer(conf["output"].as<string>(), output_format, action_table);
+    // prefork mode: everything is loaded and read-only from here on, so the
+    // workers share it with this process until they exit
+    const unsigned nworkers = conf["workers"].as<unsigned>();
+    unique_ptr<ForkedParses> forked;
+    if (nworkers > 0) {
+      const unsigned kChunk = 16;  // sentences per job
+      const unsigned njobs = (corpus_size + kChunk - 1) / kChunk;
+      forked.reset(new ForkedParses(corpus.sentencesDev, njobs));
+      PreforkPool pool(nworkers);
+      const unsigned lost = pool.run(njobs, [&](unsigned job) {
+        const WorkerCounters start = WorkerCounters::now(parse_cache.get());
+        vector<int> heads, rels;
+        for (unsigned sii = job * kChunk; sii < min(corpus_size, (job + 1) * kChunk); ++sii) {
+          const vector<unsigned>& sentence=corpus.sentencesDev[sii];
+          const vector<unsigned> tsentence = model_words(sentence, corpus.sentencesStrDev[sii]);
+          DecodeStats stats;
+          double r = 0;
+          vector<unsigned> pred = decode(decoder.get(), &budget, sentence, tsentence, corpus.sentencesPosDev[sii],
+                                         corpus.sentencesStrDev[sii], &r, &stats);
+          compute_heads(sentence.size(), pred, action_table, &heads, &rels);
+          forked->store(sii, heads, rels);
+          forked->right[sii] = r;
+          forked->state[sii] = stats.degraded ? ForkedParses::DEGRADED : ForkedParses::PARSED;
+        }
+        forked->counters[job] = WorkerCounters::now(parse_cache.get()).since(start);
+      });
+      for (unsigned job = 0; job < njobs; ++job) forked->counters[job].add_to(parse_cache.get());
+      cerr << "Parsed in " << nworkers << " worker processes (" << pool.crashes << " crashed, "
+           << pool.restarts << " restarted, " << lost << " jobs of " << kChunk << " sentences given up)" << endl;
+    }
+    // several threads: all the sentences are parsed first, then evaluated and
+    // written in order below
+    vector<vector<unsigned>> threaded_preds;
+    vector<DecodeStats> threaded_stats;
+    if (nthreads > 1) {
+      threaded_preds.resize(corpus_size);
+      threaded_stats.resize(corpus_size);
+      vector<unsigned> lengths(corpus_size);
+      for (unsigned sii = 0; sii < corpus_size; ++sii) lengths[sii] = corpus.sentencesDev[sii].size();
+      ParseScheduler scheduler(nthreads, schedule);
+      if (!replicas.empty()) scheduler.thread_init = pin_thread;
+      scheduler.run(lengths, [&](unsigned sii) {
+        const vector<unsigned>& sentence=corpus.sentencesDev[sii];
+        const vector<unsigned> tsentence = model_words(sentence, corpus.sentencesStrDev[sii]);
+        double r = 0;
+        threaded_preds[sii] = decode(local_decoder(), &budget, sentence, tsentence, corpus.sentencesPosDev[sii],
+                                     corpus.sentencesStrDev[sii], &r, &threaded_stats[sii]);
+      });
+      scheduler.report(cerr);
+    }
+    unsigned peak_live_states = 0;
     for (unsigned sii = 0; sii < corpus_size; ++sii) {
       const vector<unsigned>& sentence=corpus.sentencesDev[sii];
       const vector<unsigned>& sentencePos=corpus.sentencesPosDev[sii];
       const vector<string>& sentenceUnkStr=corpus.sentencesStrDev[sii];
       const vector<unsigned>& actions=corpus.correct_act_sentDev[sii];
-      vector<unsigned> tsentence=sentence;
-      for (auto& w : tsentence)
-        if (training_vocab.count(w) == 0) w = kUNK;
-      ComputationGraph cg;
       double lp = 0;
+      DecodeStats stats;
       vector<unsigned> pred;
-      pred = parser.log_prob_parser(&cg,sentence,tsentence,sentencePos,vector<unsigned>(),corpus.actions,corpus.intToWords,&right);
+      if (forked) {
+        forked->load(sii, &hyp_heads, &hyp_rels);
+        right += forked->right[sii];
+        stats.degraded = forked->state[sii] == ForkedParses::DEGRADED;
+        if (forked->state[sii] == ForkedParses::MISSING) {
+          cerr << "FAILED sentence " << sii << " (" << sentence.size() - 1 << " words): its worker crashed" << endl;
+          hyp_heads.assign(sentence.size(), -1);
+          hyp_rels.assign(sentence.size(), -1);
+        }
+      } else if (nthreads > 1) {
+        pred.swap(threaded_preds[sii]);
+        stats = threaded_stats[sii];
+        peak_live_states = max(peak_live_states, stats.peak_live_states);
+      } else {
+        const vector<unsigned> tsentence = model_words(sentence, sentenceUnkStr);
+        pred = decode(decoder.get(), &budget, sentence, tsentence, sentencePos, sentenceUnkStr, &right, &stats);
+        peak_live_states = max(peak_live_states, stats.peak_live_states);
+      }
+      if (memory_report_requested) {
+        memory_report_requested = 0;
+        print_memory_report(decoder.get());
+      }
+      if (stats.degraded)
+        cerr << "DEGRADED sentence " << sii << " (" << sentence.size() - 1 << " words): parse budget exhausted, "
+             << "remaining transitions completed by rule" << endl;
       llh -= lp;
       trs += actions.size();
-      map<int, string> rel_ref, rel_hyp;
-      map<int,int> ref = parser.compute_heads(sentence.size(), actions, corpus.actions, &rel_ref);
-      map<int,int> hyp = parser.compute_heads(sentence.size(), pred, corpus.actions, &rel_hyp);
-      output_conll(sentence, sentencePos, sentenceUnkStr, corpus.intToWords, corpus.intToPos, hyp, rel_hyp);
-      correct_heads_unlabeled += compute_correct(ref, hyp, sentence.size() - 1);
-      correct_heads_labeled += compute_correct(ref, hyp, rel_ref, rel_hyp, sentence.size() - 1);
-      total_heads += sentence.size() - 1;
+      PROFILE_TIMER(eval_timer);
+      if (!forked) compute_heads(sentence.size(), pred, action_table, &hyp_heads, &hyp_rels);
+      eval.add(gold_heads[sii], gold_rels[sii], hyp_heads, hyp_rels, gold_punct[sii]);
+      PROFILE_LAP(eval_timer, PROFILE_COMPUTE_HEADS);
+      writer.write(sentence.size() - 1,
+                   [&](unsigned i) -> const string& {
+                     return sentenceUnkStr[i].empty() ? corpus.intToWords[sentence[i]] : sentenceUnkStr[i];
+                   },
+                   [&](unsigned i) -> const string& { return pos_string(sii, i); },
+                   hyp_heads, hyp_rels, stats.degraded);
+      PROFILE_LAP(eval_timer, PROFILE_OUTPUT);
+    }
+    writer.flush();
+    if (!writer.good())
+      cerr << "Error writing the parses to " << conf["output"].as<string>() << endl;
+    if (trace) {
+      if (trace->good())
+        cerr << "Recorded " << trace->records << " sentences to " << conf["record_trace"].as<string>() << endl;
+      else
+        cerr << "Error writing the trace to " << conf["record_trace"].as<string>() << endl;
+      trace.reset();
     }
     auto t_end = std::chrono::high_resolution_clock::now();
-    cerr << "TEST llh=" << llh << " ppl: " << exp(llh / trs) << " err: " << (trs - right) / trs << " uas: " << (correct_heads_unlabeled / total_heads) << " las: " << (correct_heads_labeled / total_heads) << "\t[" << corpus_size << " sents in " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << " ms]" << endl;
+    cerr << "TEST llh=" << llh << " ppl: " << exp(llh / trs) << " err: " << (trs - right) / trs << " uas: " << eval.uas() << " las: " << eval.las() << "\t[" << corpus_size << " sents in " << std::chrono::duration<double, std::milli>(t_end-t_start).count() << " ms]" << endl;
+    if (conf.count("eval_breakdown"))
+      eval.report(cerr, action_table);
+    else
+      cerr << "TEST without punctuation: uas: " << eval.uas_nopunct() << " las: " << eval.las_nopunct() << endl;
+    if (decoder && !forked)
+      cerr << "Peak live LSTM states per sentence: " << peak_live_states << endl;
+    if (parse_cache)
+      cerr << "Parse cache: " << parse_cache->hits << " hits, " << parse_cache->misses << " misses (hit rate "
+           << parse_cache->hit_rate() << "), " << parse_cache->evictions << " evictions, "
+           << parse_cache->invalidations << " invalidations" << endl;
+    if (budget.limited())
+      cerr << "Parse budget: " << degradation_counters.degraded << " of " << degradation_counters.sentences
+           << " sentences degraded (" << degradation_counters.deadline_hits << " deadline, "
+           << degradation_counters.transition_cap_hits << " transition cap, "
+           << degradation_counters.forced_transitions << " forced transitions)" << endl;
+    if (memory_report)
+      print_memory_report(decoder.get());
+#ifdef COUNT_ALLOCATIONS
+    cerr << "Heap allocations: " << (heap_allocations - allocations_start)
+         << " (" << double(heap_allocations - allocations_start) / corpus_size << " per sentence)" << endl;
+#endif
   }
+  if (profiler.enabled)
+    profiler.report(cerr);
   for (unsigned i = 0; i < corpus.actions.size(); ++i) {
     //cerr << corpus.actions[i] << '\t' << parser.p_r->values[i].transpose() << endl;
     //cerr << corpus.actions[i] << '\t' << parser.p_p2a->values.col(i).transpose() << endl;
@@ -0,0 +1,136 @@
+#include "lstm-parser.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+
+cpyp::Corpus corpus;
+unsigned LAYERS = 2;
+unsigned INPUT_DIM = 40;
+unsigned HIDDEN_DIM = 60;
+unsigned ACTION_DIM = 36;
+unsigned PRETRAINED_DIM = 50;
+unsigned LSTM_INPUT_DIM = 60;
+unsigned POS_DIM = 10;
+unsigned REL_DIM = 8;
+
+bool USE_POS = false;
+
+unsigned kROOT_SYMBOL = 0;
+unsigned ACTION_SIZE = 0;
+unsigned VOCAB_SIZE = 0;
+unsigned POS_SIZE = 0;
+unsigned OOV_BUCKETS = 0;
+
+vector<unsigned> possible_actions;
+unordered_map<unsigned, vector<float>> pretrained;
+DegradationCounters degradation_counters;
+Profiler profiler;
+
+#ifdef COUNT_ALLOCATIONS
+// -DCOUNT_ALLOCATIONS=ON counts every heap allocation, to measure what the
+// test loop allocates per sentence (cnn's graph nodes, the actions returned
+// by the parser, evaluation and output)
+std::atomic<unsigned long> heap_allocations(0);
+
+void* operator new(size_t n) {
+  ++heap_allocations;
+  if (void* p = malloc(n)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+#endif
+
+// returns this thread's computation graph, emptied for a new sentence.
+// cnn only supports one graph at a time, so instead of constructing and
+// tearing one down per sentence we keep a single graph alive and reuse it.
+ComputationGraph& new_sentence_graph() {
+  static thread_local ComputationGraph hg;
+  hg.clear();
+  hg.invalidate();
+  return hg;
+}
+
+unsigned oov_bucket(const string& word, unsigned unk) {
+  if (OOV_BUCKETS == 0) return unk;
+  uint32_t h = 2166136261u;  // FNV-1a
+  for (unsigned char c : word) h = (h ^ c) * 16777619u;
+  return VOCAB_SIZE + h % OOV_BUCKETS;
+}
+
+void init_pretrained(istream &in) {
+  string line;
+  vector<float> v(PRETRAINED_DIM, 0);
+  string word;
+  while (getline(in, line)) {
+    if (word.empty() && line.find('.') == std::string::npos)
+      continue; // first line contains vocabulary size and dimensions
+    istringstream lin(line);
+    lin >> word;
+    for (unsigned i = 0; i < PRETRAINED_DIM; ++i) lin >> v[i];
+    unsigned id = corpus.get_or_add_word(word);
+    pretrained[id] = v;
+  }
+}
+
+void add_model_memory(const ParserBuilder& parser, unsigned used_words, MemoryReport* report) {
+  const char* lstm_names[] = {"stack_lstm", "buffer_lstm", "action_lstm"};
+  const LSTMBuilder* lstms[] = {&parser.stack_lstm, &parser.buffer_lstm, &parser.action_lstm};
+  for (unsigned i = 0; i < 3; ++i) {
+    size_t b = 0;
+    for (auto& layer : lstms[i]->params)
+      for (auto p : layer) b += param_bytes(p);
+    report->add("model", lstm_names[i], b);
+  }
+  const size_t w_row = 2 * INPUT_DIM * sizeof(float);
+  report->add("model", "p_w (word embeddings)", param_bytes(parser.p_w),
+              VOCAB_SIZE > used_words ? (VOCAB_SIZE - used_words) * w_row : 0,
+              "rows of words that only occur in the pretrained embeddings or the dev set are never looked up");
+  if (parser.p_t) {
+    const size_t t_row = PRETRAINED_DIM * sizeof(float);
+    report->add("model", "p_t (pretrained embeddings)", param_bytes(parser.p_t),
+                VOCAB_SIZE * t_row + (VOCAB_SIZE - min<size_t>(VOCAB_SIZE, pretrained.size())) * t_row,
+                "gradients are never used, and rows without a pretrained vector are never looked up");
+  }
+  if (parser.p_p) {
+    const unsigned used_pos = min(POS_SIZE, corpus.npos + 1);
+    report->add("model", "p_p (POS embeddings)", param_bytes(parser.p_p),
+                (POS_SIZE - used_pos) * 2 * POS_DIM * sizeof(float),
+                "POS_SIZE = npos + 10 leaves rows for tags that do not occur in the training or dev data");
+  }
+  report->add("model", "p_a (action embeddings)", param_bytes(parser.p_a), 2 * ACTION_DIM * sizeof(float),
+              "ACTION_SIZE = nactions + 1");
+  report->add("model", "p_r (relation embeddings)", param_bytes(parser.p_r), 2 * REL_DIM * sizeof(float),
+              "ACTION_SIZE = nactions + 1");
+  size_t b = 0;
+  for (const Parameters* p : {parser.p_pbias, parser.p_A, parser.p_B, parser.p_S, parser.p_H, parser.p_D,
+                              parser.p_R, parser.p_w2l, parser.p_p2l, parser.p_t2l, parser.p_ib, parser.p_cbias,
+                              parser.p_p2a, parser.p_action_start, parser.p_abias, parser.p_buffer_guard,
+                              parser.p_stack_guard})
+    b += param_bytes(p);
+  report->add("model", "state, composition and input matrices", b);
+}
+
+void add_corpus_memory(const ParserBuilder* parser, MemoryReport* report) {
+  report->add("corpus", "training sentences and POS", heap_bytes(corpus.sentences) + heap_bytes(corpus.sentencesPos));
+  report->add("corpus", "training oracle actions", heap_bytes(corpus.correct_act_sent));
+  report->add("corpus", "dev sentences, POS and OOV strings", heap_bytes(corpus.sentencesDev) +
+              heap_bytes(corpus.sentencesPosDev) + heap_bytes(corpus.sentencesStrDev) +
+              heap_bytes(corpus.sentencesPosStrDev));
+  report->add("corpus", "dev oracle actions", heap_bytes(corpus.correct_act_sentDev));
+  report->add("corpus", "wordsToInt / intToWords", heap_bytes(corpus.wordsToInt) + heap_bytes(corpus.intToWords));
+  report->add("corpus", "posToInt / intToPos / actions", heap_bytes(corpus.posToInt) + heap_bytes(corpus.intToPos) +
+              heap_bytes(corpus.actions));
+  const size_t chars = heap_bytes(corpus.charsToInt) + heap_bytes(corpus.intToChars);
+  report->add("corpus", "charsToInt / intToChars", chars, chars, "not used by this parser");
+  size_t vectors = 0;
+  for (auto& p : pretrained) vectors += p.second.capacity() * sizeof(float);
+  report->add("pretrained", "pretrained map", heap_bytes(pretrained), parser && parser->p_t ? vectors : 0,
+              "the vectors are copied into p_t; afterwards only the keys are used (release_pretrained_vectors)");
+}
+
+void release_pretrained_vectors() {
+  for (auto& p : pretrained) vector<float>().swap(p.second);
+}
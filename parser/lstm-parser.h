@@ -0,0 +1,443 @@
+#ifndef LSTM_PARSER_H_
+#define LSTM_PARSER_H_
+
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cnn/cnn.h"
+#include "cnn/expr.h"
+#include "cnn/lstm.h"
+#include "c2.h"
+#include "distillation.h"
+#include "evaluation.h"
+#include "greedy-decoder.h"
+#include "memory-report.h"
+
+// The stack LSTM parser and the state it shares with the programs built on
+// it (lstm-parse, lstm-parse-bench). The globals are defined in
+// lstm-parser.cc and set up by each program's main().
+
+extern cpyp::Corpus corpus;
+extern unsigned LAYERS;
+extern unsigned INPUT_DIM;
+extern unsigned HIDDEN_DIM;
+extern unsigned ACTION_DIM;
+extern unsigned PRETRAINED_DIM;
+extern unsigned LSTM_INPUT_DIM;
+extern unsigned POS_DIM;
+extern unsigned REL_DIM;
+
+extern bool USE_POS;
+
+constexpr const char* ROOT_SYMBOL = "ROOT";
+extern unsigned kROOT_SYMBOL;
+extern unsigned ACTION_SIZE;
+extern unsigned VOCAB_SIZE;
+extern unsigned POS_SIZE;
+// rows after the VOCAB_SIZE rows of the word embeddings, shared by the words
+// outside the training vocabulary by hashing their surface form
+extern unsigned OOV_BUCKETS;
+
+using namespace cnn::expr;
+using namespace cnn;
+using namespace std;
+
+extern vector<unsigned> possible_actions;
+extern unordered_map<unsigned, vector<float>> pretrained;
+
+#ifdef COUNT_ALLOCATIONS
+extern std::atomic<unsigned long> heap_allocations;
+#endif
+
+// returns this thread's computation graph, emptied for a new sentence.
+ComputationGraph& new_sentence_graph();
+
+// the word embedding row of a word outside the training vocabulary: one of
+// the OOV_BUCKETS rows, chosen by a hash of its surface form that does not
+// depend on the run (or UNK without buckets)
+unsigned oov_bucket(const string& word, unsigned unk);
+
+// scratch buffers used by log_prob_parser; they are cleared (but keep their
+// capacity) at the beginning of every sentence.
+struct ParserWorkspace {
+  vector<Expression> buffer;  // variables representing word embeddings (possibly including POS info)
+  vector<int> bufferi;  // position of the words in the sentence
+  vector<Expression> stack;  // variables representing subtree embeddings
+  vector<int> stacki; // position of words in the sentence of head of subtree
+  vector<Expression> log_probs;
+  vector<Expression> args;
+  vector<unsigned> current_valid_actions;
+  vector<Expression> loss_terms;  // distillation
+  vector<pair<unsigned, float>> soft_targets;
+
+  void clear() {
+    buffer.clear();
+    bufferi.clear();
+    stack.clear();
+    stacki.clear();
+    log_probs.clear();
+    args.clear();
+    current_valid_actions.clear();
+    loss_terms.clear();
+  }
+};
+
+struct ParserBuilder {
+
+  LSTMBuilder stack_lstm; // (layers, input, hidden, trainer)
+  LSTMBuilder buffer_lstm;
+  LSTMBuilder action_lstm;
+  LookupParameters* p_w; // word embeddings
+  LookupParameters* p_t; // pretrained word embeddings (not updated)
+  LookupParameters* p_a; // input action embeddings
+  LookupParameters* p_r; // relation embeddings
+  LookupParameters* p_p; // pos tag embeddings
+  Parameters* p_pbias; // parser state bias
+  Parameters* p_A; // action lstm to parser state
+  Parameters* p_B; // buffer lstm to parser state
+  Parameters* p_S; // stack lstm to parser state
+  Parameters* p_H; // head matrix for composition function
+  Parameters* p_D; // dependency matrix for composition function
+  Parameters* p_R; // relation matrix for composition function
+  Parameters* p_w2l; // word to LSTM input
+  Parameters* p_p2l; // POS to LSTM input
+  Parameters* p_t2l; // pretrained word embeddings to LSTM input
+  Parameters* p_ib; // LSTM input bias
+  Parameters* p_cbias; // composition function bias
+  Parameters* p_p2a;   // parser state to action
+  Parameters* p_action_start;  // action bias
+  Parameters* p_abias;  // action bias
+  Parameters* p_buffer_guard;  // end of buffer
+  Parameters* p_stack_guard;  // end of stack
+
+  explicit ParserBuilder(Model* model, const unordered_map<unsigned, vector<float>>& pretrained) :
+      stack_lstm(LAYERS, LSTM_INPUT_DIM, HIDDEN_DIM, model),
+      buffer_lstm(LAYERS, LSTM_INPUT_DIM, HIDDEN_DIM, model),
+      action_lstm(LAYERS, ACTION_DIM, HIDDEN_DIM, model),
+      p_w(model->add_lookup_parameters(VOCAB_SIZE + OOV_BUCKETS, Dim(INPUT_DIM, 1))),
+      p_a(model->add_lookup_parameters(ACTION_SIZE, Dim(ACTION_DIM, 1))),
+      p_r(model->add_lookup_parameters(ACTION_SIZE, Dim(REL_DIM, 1))),
+      p_pbias(model->add_parameters(Dim(HIDDEN_DIM, 1))),
+      p_A(model->add_parameters(Dim(HIDDEN_DIM, HIDDEN_DIM))),
+      p_B(model->add_parameters(Dim(HIDDEN_DIM, HIDDEN_DIM))),
+      p_S(model->add_parameters(Dim(HIDDEN_DIM, HIDDEN_DIM))),
+      p_H(model->add_parameters(Dim(LSTM_INPUT_DIM, LSTM_INPUT_DIM))),
+      p_D(model->add_parameters(Dim(LSTM_INPUT_DIM, LSTM_INPUT_DIM))),
+      p_R(model->add_parameters(Dim(LSTM_INPUT_DIM, REL_DIM))),
+      p_w2l(model->add_parameters(Dim(LSTM_INPUT_DIM, INPUT_DIM))),
+      p_ib(model->add_parameters(Dim(LSTM_INPUT_DIM, 1))),
+      p_cbias(model->add_parameters(Dim(LSTM_INPUT_DIM, 1))),
+      p_p2a(model->add_parameters(Dim(ACTION_SIZE, HIDDEN_DIM))),
+      p_action_start(model->add_parameters(Dim(ACTION_DIM, 1))),
+      p_abias(model->add_parameters(Dim(ACTION_SIZE, 1))),
+
+      p_buffer_guard(model->add_parameters(Dim(LSTM_INPUT_DIM, 1))),
+      p_stack_guard(model->add_parameters(Dim(LSTM_INPUT_DIM, 1))) {
+    if (USE_POS) {
+      p_p = model->add_lookup_parameters(POS_SIZE, Dim(POS_DIM, 1));
+      p_p2l = model->add_parameters(Dim(LSTM_INPUT_DIM, POS_DIM));
+    } else {
+      p_p = nullptr;
+      p_p2l = nullptr;
+    }
+    if (pretrained.size() > 0) {
+      p_t = model->add_lookup_parameters(VOCAB_SIZE, Dim(PRETRAINED_DIM, 1));
+      for (auto it : pretrained)
+        p_t->Initialize(it.first, it.second);
+      p_t2l = model->add_parameters(Dim(LSTM_INPUT_DIM, PRETRAINED_DIM));
+    } else {
+      p_t = nullptr;
+      p_t2l = nullptr;
+    }
+  }
+
+static bool IsActionForbidden(const string& a, unsigned bsize, unsigned ssize, const vector<int>& stacki) {
+  if (a[1]=='W' && ssize<3) return true;
+  if (a[1]=='W') {
+        int top=stacki[stacki.size()-1];
+        int sec=stacki[stacki.size()-2];
+        if (sec>top) return true;
+  }
+
+  bool is_shift = (a[0] == 'S' && a[1]=='H');
+  bool is_reduce = !is_shift;
+  if (is_shift && bsize == 1) return true;
+  if (is_reduce && ssize < 3) return true;
+  if (bsize == 2 && // ROOT is the only thing remaining on buffer
+      ssize > 2 && // there is more than a single element on the stack
+      is_shift) return true;
+  // only attach left to ROOT
+  if (bsize == 1 && ssize == 3 && a[0] == 'R') return true;
+  return false;
+}
+
+// *** if correct_actions is empty, this runs greedy decoding ***
+// returns parse actions for input sentence (in training just returns the reference)
+// OOV handling: raw_sent will have the actual words
+//               sent will have words replaced by appropriate UNK tokens
+// this lets us use pretrained embeddings, when available, for words that were OOV in the
+// parser training data
+vector<unsigned> log_prob_parser(ComputationGraph* hg,
+                     const vector<unsigned>& raw_sent,  // raw sentence
+                     const vector<unsigned>& sent,  // sent with oovs replaced
+                     const vector<unsigned>& sentPos,
+                     const vector<unsigned>& correct_actions,
+                     const vector<string>& setOfActions,
+                     const map<unsigned, std::string>& intToWords,
+                     double *right,
+                     const ParseBudget* budget = nullptr,
+                     DecodeStats* stats = nullptr,
+                     const Distillation* distill = nullptr) {
+    vector<unsigned> results;
+    const bool build_training_graph = correct_actions.size() > 0;
+    // budgets only apply when decoding
+    BudgetClock clock(build_training_graph ? nullptr : budget);
+    if (!build_training_graph) ++degradation_counters.sentences;
+    bool degraded = false;
+    PROFILE_TIMER(timer);
+
+    stack_lstm.new_graph(*hg);
+    buffer_lstm.new_graph(*hg);
+    action_lstm.new_graph(*hg);
+    stack_lstm.start_new_sequence();
+    buffer_lstm.start_new_sequence();
+    action_lstm.start_new_sequence();
+    // variables in the computation graph representing the parameters
+    Expression pbias = parameter(*hg, p_pbias);
+    Expression H = parameter(*hg, p_H);
+    Expression D = parameter(*hg, p_D);
+    Expression R = parameter(*hg, p_R);
+    Expression cbias = parameter(*hg, p_cbias);
+    Expression S = parameter(*hg, p_S);
+    Expression B = parameter(*hg, p_B);
+    Expression A = parameter(*hg, p_A);
+    Expression ib = parameter(*hg, p_ib);
+    Expression w2l = parameter(*hg, p_w2l);
+    Expression p2l;
+    if (USE_POS)
+      p2l = parameter(*hg, p_p2l);
+    Expression t2l;
+    if (p_t2l)
+      t2l = parameter(*hg, p_t2l);
+    Expression p2a = parameter(*hg, p_p2a);
+    Expression abias = parameter(*hg, p_abias);
+    Expression action_start = parameter(*hg, p_action_start);
+
+    action_lstm.add_input(action_start);
+    PROFILE_LAP(timer, PROFILE_SETUP);
+
+    static thread_local ParserWorkspace ws;
+    ws.clear();
+    vector<Expression>& buffer = ws.buffer;
+    vector<int>& bufferi = ws.bufferi;
+    buffer.resize(sent.size() + 1);
+    bufferi.resize(sent.size() + 1);
+    // precompute buffer representation from left to right
+
+    for (unsigned i = 0; i < sent.size(); ++i) {
+      assert(sent[i] < VOCAB_SIZE + OOV_BUCKETS);
+      Expression w =lookup(*hg, p_w, sent[i]);
+
+      vector<Expression>& args = ws.args;
+      args.clear();
+      args.push_back(ib); // learn embeddings
+      args.push_back(w2l);
+      args.push_back(w);
+      if (USE_POS) { // learn POS tag?
+        Expression p = lookup(*hg, p_p, sentPos[i]);
+        args.push_back(p2l);
+        args.push_back(p);
+      }
+      if (p_t && pretrained.count(raw_sent[i])) {  // include fixed pretrained vectors?
+        Expression t = const_lookup(*hg, p_t, raw_sent[i]);
+        args.push_back(t2l);
+        args.push_back(t);
+      }
+      buffer[sent.size() - i] = rectify(affine_transform(args));
+      bufferi[sent.size() - i] = i;
+    }
+    // dummy symbol to represent the empty buffer
+    buffer[0] = parameter(*hg, p_buffer_guard);
+    bufferi[0] = -999;
+    for (auto& b : buffer)
+      buffer_lstm.add_input(b);
+    PROFILE_LAP(timer, PROFILE_BUFFER);
+
+    vector<Expression>& stack = ws.stack;
+    vector<int>& stacki = ws.stacki;
+    stack.push_back(parameter(*hg, p_stack_guard));
+    stacki.push_back(-999); // not used for anything
+    // drive dummy symbol on stack through LSTM
+    stack_lstm.add_input(stack.back());
+    vector<Expression>& log_probs = ws.log_probs;
+    unsigned action_count = 0;  // incremented at each prediction
+    while(stack.size() > 2 || buffer.size() > 1) {
+      if (clock.exhausted(action_count)) {
+        complete_parse(*budget, setOfActions, IsActionForbidden, stacki, bufferi, &results);
+        degraded = true;
+        break;
+      }
+      // get list of possible actions for the current parser state
+      vector<unsigned>& current_valid_actions = ws.current_valid_actions;
+      current_valid_actions.clear();
+      for (auto a: possible_actions) {
+        if (IsActionForbidden(setOfActions[a], buffer.size(), stack.size(), stacki))
+          continue;
+        current_valid_actions.push_back(a);
+      }
+      PROFILE_LAP(timer, PROFILE_VALID_ACTIONS);
+
+      // p_t = pbias + S * slstm + B * blstm + A * almst
+      Expression p_t = affine_transform({pbias, S, stack_lstm.back(), B, buffer_lstm.back(), A, action_lstm.back()});
+      Expression nlp_t = rectify(p_t);
+      // r_t = abias + p2a * nlp
+      Expression r_t = affine_transform({abias, p2a, nlp_t});
+
+      // adist = log_softmax(r_t, current_valid_actions)
+      Expression adiste = log_softmax(r_t, current_valid_actions);
+      PROFILE_LAP(timer, PROFILE_SCORE);
+      const float* adist = hg->incremental_forward().v;
+      double best_score = adist[current_valid_actions[0]];
+      unsigned best_a = current_valid_actions[0];
+      for (unsigned i = 1; i < current_valid_actions.size(); ++i) {
+        if (adist[current_valid_actions[i]] > best_score) {
+          best_score = adist[current_valid_actions[i]];
+          best_a = current_valid_actions[i];
+        }
+      }
+      PROFILE_LAP(timer, PROFILE_FORWARD);
+      unsigned action = best_a;
+      if (build_training_graph) {  // if we have reference actions (for training) use the reference action
+        action = correct_actions[action_count];
+        if (best_a == action) { (*right)++; }
+      }
+      if (distill && distill->record)
+        distill->record->add_step(adist, current_valid_actions, distill->topk);
+      if (distill && distill->targets) {  // train on the teacher's distribution
+        vector<Expression>& terms = ws.loss_terms;
+        terms.clear();
+        if (distill->weight < 1) terms.push_back(pick(adiste, action) * (1 - distill->weight));
+        // both distributions are softened by T, and the soft term scaled by
+        // T^2 so that its gradients keep their size as T changes
+        const float T = distill->temperature;
+        Expression soft = T == 1 ? adiste : log_softmax(r_t * (1 / T), current_valid_actions);
+        distill->targets->targets(action_count, T, &ws.soft_targets);
+        for (auto& q : ws.soft_targets) terms.push_back(pick(soft, q.first) * (distill->weight * T * T * q.second));
+        log_probs.push_back(sum(terms));
+      } else {
+        log_probs.push_back(pick(adiste, action));
+      }
+      ++action_count;
+      results.push_back(action);
+
+      // add current action to action LSTM
+      Expression actione = lookup(*hg, p_a, action);
+      action_lstm.add_input(actione);
+      PROFILE_LAP(timer, PROFILE_LSTM);
+
+      // get relation embedding from action (TODO: convert to relation from action?)
+      Expression relation = lookup(*hg, p_r, action);
+
+      // do action
+      const string& actionString=setOfActions[action];
+      const char ac = actionString[0];
+      const char ac2 = actionString[1];
+
+
+      if (ac =='S' && ac2=='H') {  // SHIFT
+        assert(buffer.size() > 1); // dummy symbol means > 1 (not >= 1)
+        stack.push_back(buffer.back());
+        stack_lstm.add_input(buffer.back());
+        buffer.pop_back();
+        buffer_lstm.rewind_one_step();
+        stacki.push_back(bufferi.back());
+        bufferi.pop_back();
+      } else if (ac=='S' && ac2=='W'){ //SWAP --- Miguel
+        assert(stack.size() > 2); // dummy symbol means > 2 (not >= 2)
+
+        Expression toki, tokj;
+        unsigned ii = 0, jj = 0;
+        tokj=stack.back();
+        jj=stacki.back();
+        stack.pop_back();
+        stacki.pop_back();
+
+        toki=stack.back();
+        ii=stacki.back();
+        stack.pop_back();
+        stacki.pop_back();
+
+        buffer.push_back(toki);
+        bufferi.push_back(ii);
+
+        stack_lstm.rewind_one_step();
+        stack_lstm.rewind_one_step();
+
+        buffer_lstm.add_input(buffer.back());
+
+        stack.push_back(tokj);
+        stacki.push_back(jj);
+
+        stack_lstm.add_input(stack.back());
+      } else { // LEFT or RIGHT
+        assert(stack.size() > 2); // dummy symbol means > 2 (not >= 2)
+        assert(ac == 'L' || ac == 'R');
+        Expression dep, head;
+        unsigned depi = 0, headi = 0;
+        (ac == 'R' ? dep : head) = stack.back();
+        (ac == 'R' ? depi : headi) = stacki.back();
+        stack.pop_back();
+        stacki.pop_back();
+        (ac == 'R' ? head : dep) = stack.back();
+        (ac == 'R' ? headi : depi) = stacki.back();
+        stack.pop_back();
+        stacki.pop_back();
+        // composed = cbias + H * head + D * dep + R * relation
+        Expression composed = affine_transform({cbias, H, head, D, dep, R, relation});
+        Expression nlcomposed = tanh(composed);
+        PROFILE_LAP(timer, PROFILE_COMPOSE);
+        stack_lstm.rewind_one_step();
+        stack_lstm.rewind_one_step();
+        stack_lstm.add_input(nlcomposed);
+        stack.push_back(nlcomposed);
+        stacki.push_back(headi);
+      }
+      PROFILE_LAP(timer, PROFILE_LSTM);
+    }
+    if (stats) {
+      stats->transitions = results.size();
+      stats->degraded = degraded;
+    }
+    if (degraded) return results;
+    assert(stack.size() == 2); // guard symbol, root
+    assert(stacki.size() == 2);
+    assert(buffer.size() == 1); // guard symbol
+    assert(bufferi.size() == 1);
+    Expression tot_neglogprob = -sum(log_probs);
+    assert(tot_neglogprob.pg != nullptr);
+    return results;
+  }
+};
+
+// reads word embeddings in text format into the pretrained table, adding
+// their words to the corpus vocabulary
+void init_pretrained(istream &in);
+
+// adds the parameters of the parser (with their gradients) to a memory
+// report. used_words is the number of rows of the word embeddings that can
+// be looked up: the training vocabulary and UNK.
+void add_model_memory(const ParserBuilder& parser, unsigned used_words, MemoryReport* report);
+
+// adds the corpus structures and the pretrained embeddings map
+void add_corpus_memory(const ParserBuilder* parser, MemoryReport* report);
+
+// frees the vectors of the pretrained map once they have been copied into
+// the model (or a decoder was loaded): afterwards only its keys are used, to
+// know which words have a pretrained vector
+void release_pretrained_vectors();
+
+#endif
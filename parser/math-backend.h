@@ -0,0 +1,43 @@
+#ifndef MATH_BACKEND_H_
+#define MATH_BACKEND_H_
+
+#include <Eigen/Core>
+
+// The matrix backend is chosen when building (cmake -DBLAS_BACKEND=eigen,
+// openblas, blis or mkl; see the top-level CMakeLists.txt). Eigen hands its
+// large products to the BLAS library, and only parallelizes matrix-matrix
+// products itself (with -DUSE_OPENMP=ON): the matrix-vector products of a
+// single sentence always run on one thread unless the BLAS library splits
+// them.
+
+#if defined(PARSER_BLAS_OPENBLAS)
+extern "C" void openblas_set_num_threads(int);
+#elif defined(PARSER_BLAS_BLIS)
+extern "C" void bli_thread_set_num_threads(long);
+#endif
+
+inline const char* math_backend_name() {
+#if defined(PARSER_BLAS_OPENBLAS)
+  return "openblas";
+#elif defined(PARSER_BLAS_BLIS)
+  return "blis";
+#elif defined(PARSER_BLAS_MKL)
+  return "mkl";
+#else
+  return "eigen";
+#endif
+}
+
+// threads used by one matrix product, in Eigen and in the BLAS library
+inline void set_math_threads(int n) {
+  Eigen::setNbThreads(n);
+#if defined(PARSER_BLAS_OPENBLAS)
+  openblas_set_num_threads(n);
+#elif defined(PARSER_BLAS_BLIS)
+  bli_thread_set_num_threads(n);
+#elif defined(PARSER_BLAS_MKL)
+  mkl_set_num_threads(n);
+#endif
+}
+
+#endif
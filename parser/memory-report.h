@@ -0,0 +1,143 @@
+#ifndef MEMORY_REPORT_H_
+#define MEMORY_REPORT_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "cnn/cnn.h"
+
+// Estimates of the heap memory held by the standard containers, assuming
+// libstdc++'s layouts: strings of up to 15 characters are stored inline, a
+// std::map node carries a 32 byte header and an unordered_map node a next
+// pointer and the cached hash. Allocator overhead is not counted.
+
+inline size_t heap_bytes(unsigned) { return 0; }
+inline size_t heap_bytes(int) { return 0; }
+inline size_t heap_bytes(float) { return 0; }
+inline size_t heap_bytes(const std::string& s) { return s.capacity() > 15 ? s.capacity() + 1 : 0; }
+template <class T> size_t heap_bytes(const std::vector<T>& v);
+template <class K, class V> size_t heap_bytes(const std::map<K, V>& m);
+template <class K, class V, class H> size_t heap_bytes(const std::unordered_map<K, V, H>& m);
+template <class K, class H> size_t heap_bytes(const std::unordered_set<K, H>& m);
+
+template <class T> size_t heap_bytes(const std::vector<T>& v) {
+  size_t b = v.capacity() * sizeof(T);
+  for (auto& x : v) b += heap_bytes(x);
+  return b;
+}
+
+template <class K, class V> size_t heap_bytes(const std::map<K, V>& m) {
+  size_t b = m.size() * (32 + sizeof(std::pair<const K, V>));
+  for (auto& x : m) b += heap_bytes(x.first) + heap_bytes(x.second);
+  return b;
+}
+
+template <class K, class V, class H> size_t heap_bytes(const std::unordered_map<K, V, H>& m) {
+  size_t b = m.bucket_count() * sizeof(void*) + m.size() * (2 * sizeof(void*) + sizeof(std::pair<const K, V>));
+  for (auto& x : m) b += heap_bytes(x.first) + heap_bytes(x.second);
+  return b;
+}
+
+template <class K, class H> size_t heap_bytes(const std::unordered_set<K, H>& m) {
+  return m.bucket_count() * sizeof(void*) + m.size() * (2 * sizeof(void*) + sizeof(K));
+}
+
+// bytes of a parameter matrix or lookup table, with its gradients
+inline size_t param_bytes(const cnn::Parameters* p) {
+  return p ? 2 * p->values.d.size() * sizeof(float) : 0;
+}
+
+inline size_t param_bytes(const cnn::LookupParameters* p) {
+  if (!p) return 0;
+  size_t b = heap_bytes(p->non_zero_grads);
+  for (auto& t : p->values) b += 2 * t.d.size() * sizeof(float);
+  return b;
+}
+
+// a breakdown of memory by group (model, corpus, ...) and item; items can
+// carry a note, e.g. to flag memory that is allocated but never used
+class MemoryReport {
+ public:
+  void add(const std::string& group, const std::string& name, size_t bytes,
+           size_t unused = 0, const std::string& note = "") {
+    items.push_back(Item{group, name, bytes, unused, note});
+  }
+
+  void print(std::ostream& out) const {
+    std::vector<std::string> groups;  // in order of appearance
+    std::map<std::string, size_t> totals;
+    size_t total = 0, unused = 0;
+    for (auto& i : items) {
+      if (!totals.count(i.group)) groups.push_back(i.group);
+      totals[i.group] += i.bytes;
+      total += i.bytes;
+      unused += i.unused;
+    }
+    out << "Memory report (estimated; bytes, MB):\n" << std::fixed << std::setprecision(2);
+    for (auto& group : groups) {
+      out << "  " << std::left << std::setw(34) << group << std::right << std::setw(14) << totals[group]
+          << std::setw(10) << totals[group] / 1048576. << '\n';
+      for (auto& i : items) {
+        if (i.group != group) continue;
+        out << "    " << std::left << std::setw(32) << i.name << std::right << std::setw(14) << i.bytes
+            << std::setw(10) << i.bytes / 1048576.;
+        if (i.unused) out << "  UNUSED " << i.unused << " bytes";
+        if (!i.note.empty()) out << "  (" << i.note << ")";
+        out << '\n';
+      }
+    }
+    out << "  " << std::left << std::setw(34) << "total" << std::right << std::setw(14) << total
+        << std::setw(10) << total / 1048576. << "  of which unused: " << unused << " bytes\n";
+  }
+
+ private:
+  struct Item {
+    std::string group, name;
+    size_t bytes, unused;
+    std::string note;
+  };
+  std::vector<Item> items;
+};
+
+// largest computation graph seen for each range of sentence lengths, as the
+// number of nodes and the floats of their values (doubled for the gradients
+// when the graph was run backward)
+class GraphMemory {
+ public:
+  void add(unsigned sent_len, const cnn::ComputationGraph& cg, bool backward) {
+    size_t floats = 0;
+    for (auto n : cg.nodes) floats += n->dim.size();
+    const size_t bytes = (backward ? 2 : 1) * floats * sizeof(float);
+    std::lock_guard<std::mutex> lock(mutex);
+    Peak& p = peaks[std::min(sent_len / 10, 10u)];
+    p.bytes = std::max(p.bytes, bytes);
+    p.nodes = std::max<size_t>(p.nodes, cg.nodes.size());
+  }
+
+  void print(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (peaks.empty()) return;
+    out << "Peak computation graph per sentence length (words, nodes, bytes):\n";
+    for (auto& p : peaks) {
+      out << "  " << std::setw(4) << p.first * 10 << '-';
+      if (p.first < 10) out << std::left << std::setw(4) << p.first * 10 + 9; else out << "    ";
+      out << std::right << std::setw(10) << p.second.nodes << std::setw(14) << p.second.bytes << '\n';
+    }
+  }
+
+ private:
+  struct Peak { size_t nodes = 0, bytes = 0; };
+  std::map<unsigned, Peak> peaks;
+  mutable std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef NUMA_PLACEMENT_H_
+#define NUMA_PLACEMENT_H_
+
+#include <cstdio>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sched.h>
+#ifdef HAVE_NUMA
+#include <numa.h>
+#endif
+
+// the node of the calling thread once pinned (-1 otherwise)
+inline int& current_numa_node() {
+  static thread_local int node = -1;
+  return node;
+}
+
+// Where the CPUs are on a NUMA machine, and pinning of threads to them.
+// With libnuma (cmake finds it and defines HAVE_NUMA) the topology comes
+// from it and a pinned thread allocates on its own node even when the
+// process runs under another memory policy; without it the topology is read
+// from /sys and placement relies on the kernel's default first-touch policy,
+// which also allocates on the node of the thread that first writes a page.
+// Either way, data built by a pinned thread is local to its node.
+class NumaTopology {
+ public:
+  NumaTopology() {
+#ifdef HAVE_NUMA
+    if (numa_available() >= 0) {
+      struct bitmask* mask = numa_allocate_cpumask();
+      for (int n = 0; n <= numa_max_node(); ++n) {
+        if (numa_node_to_cpus(n, mask) != 0) continue;
+        std::vector<int> cpus;
+        for (unsigned c = 0; c < mask->size; ++c)
+          if (numa_bitmask_isbitset(mask, c)) cpus.push_back(c);
+        if (!cpus.empty()) node_cpus.push_back(cpus);
+      }
+      numa_free_cpumask(mask);
+    }
+#else
+    for (unsigned n = 0;; ++n) {
+      std::ifstream in("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+      std::string list;
+      if (!getline(in, list)) break;
+      std::vector<int> cpus = parse_cpulist(list);
+      if (!cpus.empty()) node_cpus.push_back(cpus);
+    }
+#endif
+    if (node_cpus.empty()) {  // not NUMA (or not Linux): one node with every CPU
+      std::vector<int> cpus;
+      cpu_set_t set;
+      if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        for (int c = 0; c < CPU_SETSIZE; ++c)
+          if (CPU_ISSET(c, &set)) cpus.push_back(c);
+      node_cpus.push_back(cpus);
+    }
+  }
+
+  unsigned nodes() const { return node_cpus.size(); }
+
+  // thread t of a pool goes to node t % nodes, on the next core of that node
+  unsigned node_of_thread(unsigned t) const { return t % nodes(); }
+  int cpu_of_thread(unsigned t) const {
+    const std::vector<int>& cpus = node_cpus[node_of_thread(t)];
+    return cpus.empty() ? -1 : cpus[(t / nodes()) % cpus.size()];
+  }
+
+  // pins the calling thread to a CPU, and its allocations to the CPU's node
+  bool pin(unsigned thread) const {
+    const int cpu = cpu_of_thread(thread);
+    if (cpu < 0) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) return false;
+#ifdef HAVE_NUMA
+    if (numa_available() >= 0) numa_set_localalloc();
+#endif
+    current_numa_node() = node_of_thread(thread);
+    return true;
+  }
+
+  void print(std::ostream& out) const {
+    out << "NUMA: " << nodes() << " node(s)";
+#ifdef HAVE_NUMA
+    out << " (libnuma)";
+#endif
+    for (unsigned n = 0; n < nodes(); ++n) out << ", node " << n << ": " << node_cpus[n].size() << " cpus";
+    out << '\n';
+  }
+
+  std::vector<std::vector<int>> node_cpus;
+
+  // "0-3,8-11" -> 0 1 2 3 8 9 10 11
+  static std::vector<int> parse_cpulist(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream in(list);
+    std::string range;
+    while (getline(in, range, ',')) {
+      int a, b;
+      const int n = sscanf(range.c_str(), "%d-%d", &a, &b);
+      if (n < 1) continue;
+      if (n == 1) b = a;
+      for (int c = a; c <= b; ++c) cpus.push_back(c);
+    }
+    return cpus;
+  }
+};
+
+#endif
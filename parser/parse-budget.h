@@ -0,0 +1,114 @@
+#ifndef PARSE_BUDGET_H_
+#define PARSE_BUDGET_H_
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Per-sentence limits on inference work. Once a sentence exceeds its budget
+// the parser stops consulting the model and finishes the tree with a fixed
+// sequence of transitions: SHIFT while possible, then RIGHT-ARC down to the
+// last element and a final LEFT-ARC to ROOT. The completion only looks at
+// the stack and buffer sizes, so it costs next to nothing.
+struct ParseBudget {
+  double max_ms = 0;             // deadline per sentence (0 = none)
+  unsigned max_transitions = 0;  // transitions predicted by the model (0 = none)
+
+  // actions used by the completion (most frequent labels in training)
+  unsigned shift_action = 0;
+  unsigned left_action = 0;
+  unsigned right_action = 0;
+  unsigned root_action = 0;  // the last transition of every oracle sequence
+
+  bool limited() const { return max_ms > 0 || max_transitions > 0; }
+
+  // picks the completion actions from the training oracle
+  void init_actions(const std::vector<std::string>& actions,
+                    const std::vector<std::vector<unsigned>>& oracle) {
+    std::vector<unsigned> counts(actions.size(), 0), root_counts(actions.size(), 0);
+    for (auto& sent : oracle) {
+      for (auto a : sent) ++counts[a];
+      if (!sent.empty()) ++root_counts[sent.back()];
+    }
+    unsigned best_left = 0, best_right = 0, best_root = 0;
+    for (unsigned a = 0; a < actions.size(); ++a) {
+      const std::string& s = actions[a];
+      if (s[0] == 'S' && s[1] == 'H') shift_action = a;
+      if (s[0] == 'L' && counts[a] >= best_left) { best_left = counts[a]; left_action = a; }
+      if (s[0] == 'R' && counts[a] >= best_right) { best_right = counts[a]; right_action = a; }
+      if (s[0] == 'L' && root_counts[a] >= best_root) { best_root = root_counts[a]; root_action = a; }
+    }
+  }
+};
+
+// how often the budget was hit, for all sentences parsed by this process
+struct DegradationCounters {
+  std::atomic<unsigned long> sentences;
+  std::atomic<unsigned long> degraded;
+  std::atomic<unsigned long> forced_transitions;
+  std::atomic<unsigned long> deadline_hits;
+  std::atomic<unsigned long> transition_cap_hits;
+
+  DegradationCounters() : sentences(0), degraded(0), forced_transitions(0),
+                          deadline_hits(0), transition_cap_hits(0) {}
+};
+
+extern DegradationCounters degradation_counters;
+
+// measures one sentence against a budget
+class BudgetClock {
+ public:
+  explicit BudgetClock(const ParseBudget* budget) :
+      budget(budget && budget->limited() ? budget : nullptr),
+      start(std::chrono::steady_clock::now()) {}
+
+  // true once the sentence must be finished without the model
+  bool exhausted(unsigned transitions) const {
+    if (!budget) return false;
+    if (budget->max_transitions > 0 && transitions >= budget->max_transitions) {
+      ++degradation_counters.transition_cap_hits;
+      return true;
+    }
+    if (budget->max_ms > 0 &&
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() > budget->max_ms) {
+      ++degradation_counters.deadline_hits;
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  const ParseBudget* budget;
+  std::chrono::steady_clock::time_point start;
+};
+
+// finishes a parse from the positions left on the stack and the buffer
+// (both with their guard symbols), appending the forced transitions.
+template <class ForbiddenFn>
+void complete_parse(const ParseBudget& budget, const std::vector<std::string>& setOfActions,
+                    ForbiddenFn forbidden, std::vector<int> stacki, std::vector<int> bufferi,
+                    std::vector<unsigned>* results) {
+  unsigned forced = 0;
+  while (stacki.size() > 2 || bufferi.size() > 1) {
+    unsigned action;
+    if (!forbidden(setOfActions[budget.shift_action], bufferi.size(), stacki.size(), stacki)) {
+      action = budget.shift_action;
+      stacki.push_back(bufferi.back());
+      bufferi.pop_back();
+    } else {
+      const bool right = !forbidden(setOfActions[budget.right_action], bufferi.size(), stacki.size(), stacki);
+      action = right ? budget.right_action
+          : (bufferi.size() == 1 && stacki.size() == 3 ? budget.root_action : budget.left_action);
+      const int top = stacki.back();
+      stacki.pop_back();
+      if (!right) stacki.back() = top;
+    }
+    results->push_back(action);
+    ++forced;
+  }
+  ++degradation_counters.degraded;
+  degradation_counters.forced_transitions += forced;
+}
+
+#endif
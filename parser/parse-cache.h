@@ -0,0 +1,116 @@
+#ifndef PARSE_CACHE_H_
+#define PARSE_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Bounded LRU cache of parser output, keyed on the input sentence (word ids,
+// POS ids and the surface strings of OOV words, which all map to UNK). The
+// cached value is the predicted transition sequence, from which heads and
+// relations are recovered with compute_heads in linear time.
+//
+// Entries are tagged with the version of the model that produced them: any
+// lookup with a different version empties the cache, so callers only need to
+// bump their version whenever the parameters change. lookup and insert lock
+// the cache, so they can be called from several threads.
+class ParseCache {
+ public:
+  struct Key {
+    std::vector<unsigned> words;
+    std::vector<unsigned> pos;
+    std::vector<std::string> oov;
+
+    bool operator==(const Key& o) const {
+      return words == o.words && pos == o.pos && oov == o.oov;
+    }
+  };
+
+  struct Value {
+    std::vector<unsigned> actions;
+  };
+
+  explicit ParseCache(unsigned capacity) : capacity(capacity), hits(0), misses(0),
+                                           evictions(0), invalidations(0), model_version(0) {}
+
+  static uint64_t hash(const Key& k) {
+    uint64_t h = 14695981039346656037ULL;  // FNV-1a
+    auto mix = [&h](uint64_t x) { h ^= x; h *= 1099511628211ULL; };
+    for (auto w : k.words) mix(w);
+    mix(0xffffffffULL);
+    for (auto p : k.pos) mix(p);
+    for (auto& s : k.oov) {
+      mix(0xfffffffeULL);
+      for (unsigned char c : s) mix(c);
+    }
+    return h;
+  }
+
+  // returns true and fills *value if the sentence was parsed by this version
+  // of the model before
+  bool lookup(const Key& key, uint64_t version, Value* value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    check_version(version);
+    auto it = index.find(hash(key));
+    if (it == index.end() || !(it->second->key == key)) {
+      ++misses;
+      return false;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    *value = it->second->value;
+    ++hits;
+    return true;
+  }
+
+  void insert(const Key& key, uint64_t version, const Value& value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    check_version(version);
+    const uint64_t h = hash(key);
+    auto it = index.find(h);
+    if (it != index.end()) {  // a collision or a concurrent insert: keep the newest
+      entries.erase(it->second);
+      index.erase(it);
+    }
+    entries.push_front(Entry{h, key, value});
+    index[h] = entries.begin();
+    if (entries.size() > capacity) {
+      index.erase(entries.back().hash);
+      entries.pop_back();
+      ++evictions;
+    }
+  }
+
+  unsigned size() const { return entries.size(); }
+  double hit_rate() const { return hits + misses ? double(hits) / (hits + misses) : 0.; }
+
+  const unsigned capacity;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long invalidations;
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    Key key;
+    Value value;
+  };
+
+  void check_version(uint64_t version) {
+    if (version == model_version) return;
+    if (!entries.empty()) ++invalidations;
+    entries.clear();
+    index.clear();
+    model_version = version;
+  }
+
+  std::list<Entry> entries;  // most recently used first
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+  uint64_t model_version;
+  std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef PARSE_SCHEDULER_H_
+#define PARSE_SCHEDULER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <numeric>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs the parses of a batch of sentences on several threads. Parsing time
+// grows faster than sentence length, so with a static split of the batch
+// the thread that got the long sentences finishes last. Here sentences are
+// handed out longest first (round-robin over per-thread queues, so every
+// thread starts on a long one) and a thread whose queue is empty steals the
+// shortest sentence of the fullest queue, which keeps all threads busy
+// until the very end. Results are stored by sentence index by the caller,
+// so the output order is not affected.
+class ParseScheduler {
+ public:
+  enum Policy { LONGEST_FIRST, STATIC };
+
+  static bool parse_policy(const std::string& s, Policy* policy) {
+    if (s == "longest_first") *policy = LONGEST_FIRST;
+    else if (s == "static") *policy = STATIC;  // contiguous slices, no stealing (for comparison)
+    else return false;
+    return true;
+  }
+
+  ParseScheduler(unsigned threads, Policy policy) : threads(std::max(1u, threads)), policy(policy) {}
+
+  // calls work(i) for every i in [0, lengths.size()), from several threads
+  void run(const std::vector<unsigned>& lengths, const std::function<void(unsigned)>& work) {
+    const unsigned n = lengths.size();
+    std::vector<unsigned> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    if (policy == LONGEST_FIRST)
+      std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return lengths[a] > lengths[b]; });
+    std::vector<Queue> queues(threads);
+    for (unsigned k = 0; k < n; ++k) {
+      const unsigned t = policy == LONGEST_FIRST ? k % threads : uint64_t(k) * threads / n;
+      queues[t].items.push_back(order[k]);
+    }
+
+    busy_ms.assign(threads, 0);
+    items.assign(threads, 0);
+    steals = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto loop = [&](unsigned t) {
+      if (thread_init) thread_init(t);
+      for (;;) {
+        unsigned i;
+        if (!queues[t].pop_front(&i)) {
+          if (policy == STATIC || !steal(&queues, &i)) break;
+          std::lock_guard<std::mutex> lock(stats_mutex);
+          ++steals;
+        }
+        auto s = std::chrono::steady_clock::now();
+        work(i);
+        busy_ms[t] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - s).count();
+        ++items[t];
+      }
+    };
+    // with thread_init, the calling thread only waits, so that whatever
+    // thread_init does to a thread (e.g. pinning it) does not outlive run()
+    std::vector<std::thread> pool;
+    for (unsigned t = thread_init ? 0 : 1; t < threads; ++t) pool.emplace_back(loop, t);
+    if (!thread_init) loop(0);
+    for (auto& th : pool) th.join();
+    wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // busy time of all threads over threads * wall time
+  double efficiency() const {
+    const double busy = std::accumulate(busy_ms.begin(), busy_ms.end(), 0.);
+    return wall_ms > 0 ? busy / (threads * wall_ms) : 0;
+  }
+
+  void report(std::ostream& out) const {
+    out << "Scheduler: " << threads << " threads, " << (policy == STATIC ? "static" : "longest_first")
+        << ", " << wall_ms << " ms wall, efficiency " << efficiency() << ", " << steals << " steals; per thread (items, busy ms):";
+    for (unsigned t = 0; t < threads; ++t) out << ' ' << items[t] << '/' << busy_ms[t];
+    out << '\n';
+  }
+
+  // called first on each thread of run(), with the thread's number
+  std::function<void(unsigned)> thread_init;
+
+  const unsigned threads;
+  const Policy policy;
+  double wall_ms = 0;
+  std::vector<double> busy_ms;
+  std::vector<unsigned> items;
+  unsigned steals = 0;
+
+ private:
+  struct Queue {
+    std::deque<unsigned> items;  // longest first
+    std::mutex mutex;
+
+    bool pop_front(unsigned* i) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (items.empty()) return false;
+      *i = items.front();
+      items.pop_front();
+      return true;
+    }
+  };
+
+  static bool steal(std::vector<Queue>* queues, unsigned* i) {
+    for (;;) {
+      Queue* victim = nullptr;
+      size_t most = 0;
+      for (auto& q : *queues) {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.items.size() > most) { most = q.items.size(); victim = &q; }
+      }
+      if (!victim) return false;
+      std::lock_guard<std::mutex> lock(victim->mutex);
+      if (victim->items.empty()) continue;  // emptied meanwhile, look again
+      *i = victim->items.back();
+      victim->items.pop_back();
+      return true;
+    }
+  }
+
+  std::mutex stats_mutex;
+};
+
+#endif
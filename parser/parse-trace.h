@@ -0,0 +1,216 @@
+#ifndef PARSE_TRACE_H_
+#define PARSE_TRACE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A trace of the sentences given to the parser: their tokens and POS tags
+// as strings (so that it can be replayed with another model or vocabulary),
+// when each one arrived and how long it took to parse.
+//
+// File format: "LSTMTRC1", then one record per sentence, all numbers as
+// LEB128 varints: arrival (microseconds since the start of the recording),
+// latency (microseconds), number of tokens, then a word and a tag per
+// token. Strings are numbered in order of first use: 0 is followed by the
+// length and bytes of a new string, and n > 0 refers to string n - 1.
+inline const char* trace_magic() { return "LSTMTRC1"; }
+
+struct TraceRecord {
+  uint64_t arrival_us;
+  uint64_t latency_us;
+  std::vector<std::string> words;
+  std::vector<std::string> tags;
+};
+
+class TraceWriter {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  explicit TraceWriter(const std::string& fname) :
+      out(fname.c_str(), std::ios_base::out | std::ios_base::binary), start(Clock::now()) {
+    out.write(trace_magic(), 8);
+  }
+
+  // word(i) and tag(i) return the strings of token i
+  template <class WordFn, class TagFn>
+  void add(Clock::time_point arrival, Clock::time_point done, unsigned len, WordFn word, TagFn tag) {
+    put(std::chrono::duration_cast<std::chrono::microseconds>(arrival - start).count());
+    put(std::chrono::duration_cast<std::chrono::microseconds>(done - arrival).count());
+    put(len);
+    for (unsigned i = 0; i < len; ++i) {
+      put_string(word(i));
+      put_string(tag(i));
+    }
+    ++records;
+  }
+
+  bool good() { out.flush(); return out.good(); }
+
+  unsigned records = 0;
+
+ private:
+  void put(uint64_t v) {
+    do {
+      char b = v & 0x7f;
+      v >>= 7;
+      if (v) b |= 0x80;
+      out.put(b);
+    } while (v);
+  }
+
+  void put_string(const std::string& s) {
+    auto it = ids.find(s);
+    if (it != ids.end()) {
+      put(it->second + 1);
+      return;
+    }
+    put(0);
+    put(s.size());
+    out.write(s.data(), s.size());
+    const uint64_t id = ids.size();
+    ids[s] = id;
+  }
+
+  std::ofstream out;
+  const Clock::time_point start;
+  std::unordered_map<std::string, uint64_t> ids;
+};
+
+// reads a whole trace, sorted by arrival; returns false if the file is not
+// a trace or is truncated
+inline bool read_trace(const std::string& fname, std::vector<TraceRecord>* records) {
+  std::ifstream in(fname.c_str(), std::ios_base::in | std::ios_base::binary);
+  char magic[8];
+  if (!in.read(magic, 8) || !std::equal(magic, magic + 8, trace_magic())) return false;
+  auto get = [&](uint64_t* v) {
+    *v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      const int b = in.get();
+      if (b == EOF) return false;
+      *v |= uint64_t(b & 0x7f) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  };
+  std::vector<std::string> strings;
+  auto get_string = [&](std::string* s) {
+    uint64_t id;
+    if (!get(&id)) return false;
+    if (id > 0) {
+      if (id > strings.size()) return false;
+      *s = strings[id - 1];
+      return true;
+    }
+    uint64_t len;
+    if (!get(&len)) return false;
+    s->resize(len);
+    if (len && !in.read(&(*s)[0], len)) return false;
+    strings.push_back(*s);
+    return true;
+  };
+  records->clear();
+  TraceRecord r;
+  uint64_t len;
+  while (get(&r.arrival_us)) {
+    if (!get(&r.latency_us) || !get(&len)) return false;
+    r.words.resize(len);
+    r.tags.resize(len);
+    for (unsigned i = 0; i < len; ++i)
+      if (!get_string(&r.words[i]) || !get_string(&r.tags[i])) return false;
+    records->push_back(r);
+  }
+  std::stable_sort(records->begin(), records->end(),
+                   [](const TraceRecord& a, const TraceRecord& b) { return a.arrival_us < b.arrival_us; });
+  return true;
+}
+
+// Feeds a trace back to the parser on several threads. Each sentence is
+// released at its recorded arrival time divided by speed (speed 0 releases
+// them all at once, to measure the maximum throughput) and taken by the
+// next free thread. The response time of a sentence counts from its release,
+// so it includes the time it waited for a thread when the parser falls
+// behind; the service time only counts the parse.
+class TraceReplay {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  TraceReplay(unsigned threads, double speed) : threads(std::max(1u, threads)), speed(speed) {}
+
+  void run(const std::vector<TraceRecord>& records, const std::function<void(const TraceRecord&)>& parse) {
+    const unsigned n = records.size();
+    response_ms.assign(n, 0);
+    service_ms.assign(n, 0);
+    std::atomic<unsigned> next(0);
+    const Clock::time_point start = Clock::now();
+    auto loop = [&](unsigned t) {
+      if (thread_init) thread_init(t);
+      for (unsigned i; (i = next++) < n;) {
+        Clock::time_point release = start;
+        if (speed > 0) {
+          release += std::chrono::microseconds(uint64_t(records[i].arrival_us / speed));
+          std::this_thread::sleep_until(release);
+        }
+        const Clock::time_point s = Clock::now();
+        parse(records[i]);
+        const Clock::time_point e = Clock::now();
+        response_ms[i] = std::chrono::duration<double, std::milli>(e - release).count();
+        service_ms[i] = std::chrono::duration<double, std::milli>(e - s).count();
+      }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = thread_init ? 0 : 1; t < threads; ++t) pool.emplace_back(loop, t);
+    if (!thread_init) loop(0);
+    for (auto& th : pool) th.join();
+    wall_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    tokens = 0;
+    recorded_ms.resize(n);
+    for (unsigned i = 0; i < n; ++i) {
+      tokens += records[i].words.size();
+      recorded_ms[i] = records[i].latency_us / 1000.;
+    }
+  }
+
+  void report(std::ostream& out) const {
+    const unsigned n = response_ms.size();
+    out << "Replay: " << n << " sentences, " << tokens << " tokens in " << wall_ms << " ms on " << threads
+        << " threads at speed ";
+    if (speed > 0) out << speed; else out << "max";
+    out << " (" << (wall_ms > 0 ? 1000. * n / wall_ms : 0) << " sentences/s, "
+        << (wall_ms > 0 ? 1000. * tokens / wall_ms : 0) << " tokens/s)\n";
+    for (auto& row : {std::make_pair("response", &response_ms), std::make_pair("service", &service_ms),
+                      std::make_pair("recorded", &recorded_ms)}) {
+      std::vector<double> v(*row.second);
+      std::sort(v.begin(), v.end());
+      out << "  " << row.first << " ms:";
+      for (double q : {0.5, 0.9, 0.99, 0.999}) out << " p" << q * 100 << ' ' << percentile(v, q);
+      out << " max " << (v.empty() ? 0 : v.back()) << '\n';
+    }
+  }
+
+  // called first on each thread of run(), with the thread's number (see
+  // ParseScheduler::thread_init)
+  std::function<void(unsigned)> thread_init;
+
+  const unsigned threads;
+  const double speed;
+  double wall_ms = 0;
+  uint64_t tokens = 0;
+  std::vector<double> response_ms, service_ms, recorded_ms;  // by record
+
+ private:
+  static double percentile(const std::vector<double>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min<size_t>(sorted.size() - 1, size_t(q * sorted.size()))];
+  }
+};
+
+#endif
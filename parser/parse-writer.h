@@ -0,0 +1,208 @@
+#ifndef PARSE_WRITER_H_
+#define PARSE_WRITER_H_
+
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/version.hpp>
+#if BOOST_VERSION >= 107000
+#define PARSE_WRITER_ZSTD
+#include <boost/iostreams/filter/zstd.hpp>
+#endif
+
+#include "evaluation.h"
+
+// Writes parsed sentences in one of several formats. Sentences are
+// formatted into an in-memory block, which goes to the output stream only
+// when it reaches block_bytes (0 writes every sentence at once, e.g. when
+// a client waits for each parse). Files whose name ends in .gz (or .zst,
+// with Boost >= 1.70) are compressed.
+//
+// The binary format starts with "LSTMPRS2", the number of relations and
+// their names (each a uint32 length and the bytes); then every sentence is a
+// uint32 number of words followed by a uint16 head (0 for ROOT) and a uint16
+// relation id per word. Integers are little endian. The top bit of the
+// number of words marks a degraded sentence.
+//
+// A degraded sentence (whose parse budget ran out, and whose tree was
+// completed by rule) is preceded by a "# degraded = true" comment in
+// CoNLL-U and has "degraded": true in jsonl. CoNLL-X has no comment lines,
+// so it is not marked there: the caller reports it on the side.
+class ParseWriter {
+ public:
+  enum Format { CONLLX, CONLLU, JSONL, BINARY };
+
+  static bool parse_format(const std::string& s, Format* format) {
+    if (s == "conllx") *format = CONLLX;
+    else if (s == "conllu") *format = CONLLU;
+    else if (s == "jsonl") *format = JSONL;
+    else if (s == "binary") *format = BINARY;
+    else return false;
+    return true;
+  }
+
+  // fname "-" is the standard output
+  ParseWriter(const std::string& fname, Format format, const ActionTable& actions, size_t block_bytes = 1 << 20) :
+      format(format), actions(actions), block_bytes(block_bytes) {
+    if (boost::algorithm::ends_with(fname, ".gz")) {
+      out.push(boost::iostreams::gzip_compressor());
+#ifdef PARSE_WRITER_ZSTD
+    } else if (boost::algorithm::ends_with(fname, ".zst")) {
+      out.push(boost::iostreams::zstd_compressor());
+#endif
+    }
+    if (fname == "-") {
+      out.push(std::cout);
+    } else {
+      file.open(fname.c_str(), std::ios_base::out | std::ios_base::binary);
+      if (!file) failed = true;
+      out.push(file);
+    }
+    buffer.reserve(block_bytes + 4096);
+    if (format == BINARY) {
+      buffer.append("LSTMPRS2");
+      append_binary<uint32_t>(actions.nrels());
+      for (unsigned r = 0; r < actions.nrels(); ++r) {
+        append_binary<uint32_t>(actions.rel_name(r).size());
+        buffer += actions.rel_name(r);
+      }
+    }
+  }
+
+  ~ParseWriter() { close(); }
+
+  // writes what is left, then the trailer of compressed formats, and closes
+  // the file; false if any of it could not be written. Nothing can be
+  // written after it.
+  bool close() {
+    if (closed) return !failed;
+    closed = true;
+    flush();
+    failed = failed || !out.good();
+    try {
+      out.reset();  // finishes the filter chain (the gzip or zstd trailer)
+    } catch (const std::exception&) {
+      failed = true;
+    }
+    if (file.is_open()) {
+      file.close();
+      failed = failed || file.fail();
+    } else {
+      std::cout.flush();
+      failed = failed || !std::cout.good();
+    }
+    return !failed;
+  }
+
+  // a sentence of len words (ROOT excluded) with form(i) and tag(i)
+  // returning the strings of word i, and the output of compute_heads
+  template <class Form, class Tag>
+  void write(unsigned len, Form form, Tag tag, const std::vector<int>& heads, const std::vector<int>& rels,
+             bool degraded = false) {
+    switch (format) {
+      case CONLLX:
+      case CONLLU:
+        if (degraded && format == CONLLU) buffer += "# degraded = true\n";
+        for (unsigned i = 0; i < len; ++i) {
+          append_uint(i + 1);
+          buffer += '\t';
+          buffer += form(i);
+          // CoNLL-X: LEMMA, CPOSTAG, POSTAG, FEATS; CoNLL-U: LEMMA, UPOS, XPOS, FEATS
+          buffer += "\t_\t_\t";
+          buffer += tag(i);
+          buffer += "\t_\t";
+          append_uint(head(heads[i], len));
+          buffer += '\t';
+          buffer += rel_name(rels[i]);
+          buffer += "\t_\t_\n";
+        }
+        buffer += '\n';
+        break;
+      case JSONL:
+        buffer += "{\"words\": [";
+        for (unsigned i = 0; i < len; ++i) { if (i) buffer += ", "; append_json(form(i)); }
+        buffer += "], \"tags\": [";
+        for (unsigned i = 0; i < len; ++i) { if (i) buffer += ", "; append_json(tag(i)); }
+        buffer += "], \"heads\": [";
+        for (unsigned i = 0; i < len; ++i) { if (i) buffer += ", "; append_uint(head(heads[i], len)); }
+        buffer += "], \"deprels\": [";
+        for (unsigned i = 0; i < len; ++i) { if (i) buffer += ", "; append_json(rel_name(rels[i])); }
+        buffer += degraded ? "], \"degraded\": true}\n" : "]}\n";
+        break;
+      case BINARY:
+        append_binary<uint32_t>(degraded ? len | 0x80000000u : len);
+        for (unsigned i = 0; i < len; ++i) {
+          append_binary<uint16_t>(head(heads[i], len));
+          append_binary<uint16_t>(rels[i] < 0 ? 0xffff : rels[i]);
+        }
+        break;
+    }
+    ++sentences;
+    if (buffer.size() >= block_bytes) flush();
+  }
+
+  void flush() {
+    if (buffer.empty()) return;
+    out.write(buffer.data(), buffer.size());
+    out.flush();
+    buffer.clear();
+  }
+
+  bool good() const { return out.good(); }
+
+  unsigned long sentences = 0;
+
+ private:
+  // CoNLL numbering: words from 1, ROOT (position len) and unattached words are 0
+  static unsigned head(int h, unsigned len) { return h < 0 || unsigned(h) == len ? 0 : h + 1; }
+  const std::string& rel_name(int r) const {
+    static const std::string none = "_";
+    return r < 0 ? none : actions.rel_name(r);
+  }
+
+  void append_uint(unsigned v) {
+    char digits[10];
+    unsigned n = 0;
+    do { digits[n++] = '0' + v % 10; v /= 10; } while (v);
+    while (n) buffer += digits[--n];
+  }
+
+  template <class T> void append_binary(T v) {
+    for (unsigned b = 0; b < sizeof(T); ++b) buffer += char((v >> (8 * b)) & 0xff);
+  }
+
+  void append_json(const std::string& s) {
+    buffer += '"';
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        buffer += '\\';
+        buffer += c;
+      } else if ((unsigned char)c < 0x20) {
+        static const char hex[] = "0123456789abcdef";
+        buffer += "\\u00";
+        buffer += hex[(c >> 4) & 0xf];
+        buffer += hex[c & 0xf];
+      } else {
+        buffer += c;
+      }
+    }
+    buffer += '"';
+  }
+
+  const Format format;
+  const ActionTable& actions;
+  const size_t block_bytes;
+  std::string buffer;
+  bool closed = false, failed = false;
+  std::ofstream file;
+  boost::iostreams::filtering_ostream out;
+};
+
+#endif
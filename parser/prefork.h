@@ -0,0 +1,154 @@
+#ifndef PREFORK_H_
+#define PREFORK_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// An array in memory shared with the processes forked after its creation,
+// for workers to return their results to the supervisor. T must not need a
+// destructor.
+template <class T>
+class SharedArray {
+ public:
+  explicit SharedArray(size_t n) : n(n) {
+    void* p = mmap(nullptr, std::max<size_t>(1, n * sizeof(T)), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    data = static_cast<T*>(p);
+    for (size_t i = 0; i < n; ++i) new (data + i) T();
+  }
+  ~SharedArray() { munmap(data, std::max<size_t>(1, n * sizeof(T))); }
+  SharedArray(const SharedArray&) = delete;
+  SharedArray& operator=(const SharedArray&) = delete;
+
+  T& operator[](size_t i) { return data[i]; }
+  const T& operator[](size_t i) const { return data[i]; }
+  size_t size() const { return n; }
+
+ private:
+  T* data;
+  size_t n;
+};
+
+// Runs jobs in forked worker processes that share, copy-on-write, everything
+// the supervisor loaded before calling run(): the corpus, the embeddings and
+// the model are never copied as long as the workers only read them. Workers
+// take the next pending job until none is left. When one dies, the jobs it
+// had taken go back to the queue and a new worker is forked; a job that
+// crashed max_attempts workers is given up.
+class PreforkPool {
+ public:
+  explicit PreforkPool(unsigned workers, unsigned max_attempts = 3) :
+      workers(workers), max_attempts(max_attempts) {}
+
+  // work(job) runs in a worker for every job in [0, njobs) and must leave
+  // its results in shared memory. Returns the number of jobs given up.
+  unsigned run(unsigned njobs, const std::function<void(unsigned)>& work) {
+    SharedArray<std::atomic<int>> owner(njobs);  // kPending, kDone, kFailed or the pid of the worker
+    SharedArray<std::atomic<unsigned>> attempts(njobs);
+    SharedArray<std::atomic<unsigned>> hint(1);  // no pending job before it, except for jobs put back
+    for (unsigned j = 0; j < njobs; ++j) owner[j] = kPending;
+#ifdef __GLIBC__
+    malloc_trim(0);  // give the free heap back before it gets duplicated
+#endif
+    std::cout.flush();
+    std::cerr.flush();
+
+    auto pending = [&]() {
+      for (unsigned j = 0; j < njobs; ++j)
+        if (owner[j] == kPending) return true;
+      return false;
+    };
+    auto spawn = [&]() -> pid_t {
+      const pid_t pid = fork();
+      if (pid < 0) {
+        std::cerr << "fork failed: " << strerror(errno) << std::endl;
+        return pid;
+      }
+      if (pid > 0) return pid;
+      // worker
+      const int self = getpid();
+      for (;;) {
+        int job = -1;
+        for (unsigned pass = 0; pass < 2 && job < 0; ++pass) {
+          for (unsigned j = pass ? 0 : hint[0].load(); j < njobs; ++j) {
+            int expected = kPending;
+            if (owner[j].compare_exchange_strong(expected, self)) { job = j; break; }
+          }
+        }
+        if (job < 0) _exit(0);  // not exit(): the supervisor's buffers and destructors are not ours
+        hint[0] = job + 1;
+        ++attempts[job];
+        work(job);
+        owner[job] = kDone;
+      }
+    };
+
+    std::vector<pid_t> pids;
+    for (unsigned w = 0; w < workers; ++w) {
+      const pid_t pid = spawn();
+      if (pid > 0) pids.push_back(pid);
+    }
+    while (!pids.empty()) {
+      int status = 0;
+      const pid_t pid = waitpid(-1, &status, 0);
+      if (pid < 0) {
+        if (errno == EINTR) continue;
+        break;
+      }
+      auto it = std::find(pids.begin(), pids.end(), pid);
+      if (it == pids.end()) continue;
+      pids.erase(it);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "Worker " << pid << " died (";
+        if (WIFSIGNALED(status)) std::cerr << "signal " << WTERMSIG(status); else std::cerr << "exit status " << WEXITSTATUS(status);
+        std::cerr << ")";
+        for (unsigned j = 0; j < njobs; ++j) {
+          if (owner[j] != pid) continue;
+          if (attempts[j] >= max_attempts) {
+            owner[j] = kFailed;
+            std::cerr << ", giving up job " << j;
+          } else {
+            owner[j] = kPending;
+          }
+        }
+        hint[0] = 0;
+        std::cerr << std::endl;
+        ++crashes;
+      }
+      if (pending()) {
+        const pid_t replacement = spawn();
+        if (replacement > 0) pids.push_back(replacement);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ++restarts;
+      }
+    }
+    unsigned lost = 0;
+    for (unsigned j = 0; j < njobs; ++j) lost += owner[j] != kDone;
+    return lost;
+  }
+
+  const unsigned workers;
+  const unsigned max_attempts;
+  unsigned crashes = 0;
+  unsigned restarts = 0;
+
+ private:
+  static const int kPending = 0;
+  static const int kDone = -1;
+  static const int kFailed = -2;
+};
+
+#endif
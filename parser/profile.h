@@ -0,0 +1,228 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Per-phase timers for the parser. They are only compiled in with
+// -DPARSER_PROFILE (cmake -DPROFILE=ON), and only run with --profile; without
+// PARSER_PROFILE the PROFILE_* macros below expand to nothing.
+//
+// Note that with the graph parser the LSTM and composition phases only build
+// expressions: the arithmetic happens in the forward phase.
+
+enum ProfilePhase {
+  PROFILE_SETUP,          // new graph, parameter expressions
+  PROFILE_BUFFER,         // word representations and the buffer LSTM
+  PROFILE_VALID_ACTIONS,  // IsActionForbidden over all actions
+  PROFILE_SCORE,          // parser state and action scores
+  PROFILE_FORWARD,        // incremental_forward and the argmax
+  PROFILE_LSTM,           // stack/buffer/action LSTM add_input and rewind_one_step
+  PROFILE_COMPOSE,        // composition of head and dependent
+  PROFILE_BACKWARD,       // training: backward pass
+  PROFILE_UPDATE,         // training: parameter update
+  PROFILE_COMPUTE_HEADS,
+  PROFILE_OUTPUT,         // formatting and writing the parses
+  PROFILE_LOAD,           // corpus, embeddings and model loading
+  NUM_PROFILE_PHASES
+};
+
+inline const char* profile_phase_name(unsigned p) {
+  static const char* names[] = {"setup", "buffer", "valid_actions", "score", "forward", "lstm",
+                                "compose", "backward", "update", "compute_heads", "output", "load"};
+  return names[p];
+}
+
+class Profiler {
+ public:
+  Profiler() : enabled(false), sentences(kLengthBuckets) {
+    for (unsigned p = 0; p < NUM_PROFILE_PHASES; ++p) { ns[p] = 0; calls[p] = 0; }
+  }
+
+  void add(ProfilePhase p, uint64_t elapsed_ns) {
+    ns[p] += elapsed_ns;
+    ++calls[p];
+  }
+
+  // one parsed sentence: its length in words, transitions and latency
+  void add_sentence(unsigned len, unsigned transitions, double ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    SentenceStats& s = sentences[length_bucket(len)];
+    ++s.count;
+    s.words += len;
+    s.transitions += transitions;
+    s.ms += ms;
+    unsigned b = 0;
+    while (b + 1 < kLatencyBuckets && ms >= latency_edge(b)) ++b;
+    ++s.latency[b];
+  }
+
+  void report(std::ostream& out) const {
+    uint64_t total = 0;
+    for (unsigned p = 0; p < NUM_PROFILE_PHASES; ++p) total += ns[p];
+    out << "Profile (phase, total ms, calls, us/call, share):\n" << std::fixed << std::setprecision(3);
+    for (unsigned p = 0; p < NUM_PROFILE_PHASES; ++p) {
+      if (!calls[p]) continue;
+      out << "  " << std::left << std::setw(14) << profile_phase_name(p) << std::right
+          << std::setw(12) << ns[p] / 1e6 << std::setw(10) << calls[p]
+          << std::setw(12) << ns[p] / 1e3 / calls[p]
+          << std::setw(8) << std::setprecision(1) << 100. * ns[p] / total << "%\n" << std::setprecision(3);
+    }
+    out << "Sentences by length (count, transitions/sentence, transitions/word, mean ms; latency histogram in ms):\n";
+    for (unsigned b = 0; b < kLengthBuckets; ++b) {
+      const SentenceStats& s = sentences[b];
+      if (!s.count) continue;
+      out << "  " << std::setw(4) << (b ? length_edge(b - 1) + 1 : 1) << '-';
+      if (b + 1 < kLengthBuckets) out << std::left << std::setw(4) << length_edge(b); else out << "    ";
+      out << std::right << std::setw(8) << s.count
+          << std::setw(10) << std::setprecision(1) << double(s.transitions) / s.count
+          << std::setw(8) << std::setprecision(2) << double(s.transitions) / std::max<uint64_t>(1, s.words)
+          << std::setw(10) << std::setprecision(3) << s.ms / s.count << " " << std::defaultfloat;
+      for (unsigned l = 0; l < kLatencyBuckets; ++l) {
+        if (!s.latency[l]) continue;
+        if (l + 1 < kLatencyBuckets) out << " <" << latency_edge(l) << ':'; else out << " >=" << latency_edge(l - 1) << ':';
+        out << s.latency[l];
+      }
+      out << std::fixed << '\n';
+    }
+  }
+
+  bool enabled;
+
+ private:
+  static const unsigned kLengthBuckets = 7;
+  static const unsigned kLatencyBuckets = 11;
+  static unsigned length_edge(unsigned b) {
+    static const unsigned edges[] = {10, 20, 30, 40, 60, 100};
+    return edges[b];
+  }
+  static unsigned length_bucket(unsigned len) {
+    unsigned b = 0;
+    while (b + 1 < kLengthBuckets && len > length_edge(b)) ++b;
+    return b;
+  }
+  static double latency_edge(unsigned b) {
+    static const double edges[] = {0.5, 1, 2, 5, 10, 20, 50, 100, 200, 500};
+    return edges[b];
+  }
+
+  struct SentenceStats {
+    uint64_t count = 0, words = 0, transitions = 0;
+    double ms = 0;
+    uint64_t latency[kLatencyBuckets] = {};
+  };
+
+  std::atomic<uint64_t> ns[NUM_PROFILE_PHASES];
+  std::atomic<uint64_t> calls[NUM_PROFILE_PHASES];
+  std::vector<SentenceStats> sentences;
+  mutable std::mutex mutex;
+
+ public:
+  // the counts as plain data, e.g. for a forked worker to hand them to its
+  // supervisor in shared memory
+  struct Snapshot {
+    uint64_t ns[NUM_PROFILE_PHASES] = {}, calls[NUM_PROFILE_PHASES] = {};
+    SentenceStats sentences[kLengthBuckets];
+  };
+
+  Snapshot snapshot() const {
+    Snapshot s;
+    for (unsigned p = 0; p < NUM_PROFILE_PHASES; ++p) { s.ns[p] = ns[p]; s.calls[p] = calls[p]; }
+    std::lock_guard<std::mutex> lock(mutex);
+    std::copy(sentences.begin(), sentences.end(), s.sentences);
+    return s;
+  }
+
+  // the counts of end that are not in start
+  static Snapshot difference(const Snapshot& end, const Snapshot& start) {
+    Snapshot d;
+    for (unsigned p = 0; p < NUM_PROFILE_PHASES; ++p) {
+      d.ns[p] = end.ns[p] - start.ns[p];
+      d.calls[p] = end.calls[p] - start.calls[p];
+    }
+    for (unsigned b = 0; b < kLengthBuckets; ++b) {
+      SentenceStats& s = d.sentences[b];
+      const SentenceStats& e = end.sentences[b];
+      const SentenceStats& o = start.sentences[b];
+      s.count = e.count - o.count;
+      s.words = e.words - o.words;
+      s.transitions = e.transitions - o.transitions;
+      s.ms = e.ms - o.ms;
+      for (unsigned l = 0; l < kLatencyBuckets; ++l) s.latency[l] = e.latency[l] - o.latency[l];
+    }
+    return d;
+  }
+
+  void merge(const Snapshot& o) {
+    for (unsigned p = 0; p < NUM_PROFILE_PHASES; ++p) {
+      ns[p] += o.ns[p];
+      calls[p] += o.calls[p];
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (unsigned b = 0; b < kLengthBuckets; ++b) {
+      SentenceStats& s = sentences[b];
+      s.count += o.sentences[b].count;
+      s.words += o.sentences[b].words;
+      s.transitions += o.sentences[b].transitions;
+      s.ms += o.sentences[b].ms;
+      for (unsigned l = 0; l < kLatencyBuckets; ++l) s.latency[l] += o.sentences[b].latency[l];
+    }
+  }
+};
+
+extern Profiler profiler;
+
+// charges the time since its construction, or since the previous lap, to
+// the phase given to lap()
+class PhaseTimer {
+ public:
+  PhaseTimer() : start(profiler.enabled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point()) {}
+
+  double elapsed_ms() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  void lap(ProfilePhase p) {
+    if (!profiler.enabled) return;
+    const auto now = std::chrono::steady_clock::now();
+    profiler.add(p, std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+    start = now;
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start;
+};
+
+// charges its whole lifetime to one phase
+class ProfileScope {
+ public:
+  explicit ProfileScope(ProfilePhase p) : phase(p) {}
+  ~ProfileScope() { timer.lap(phase); }
+
+ private:
+  ProfilePhase phase;
+  PhaseTimer timer;
+};
+
+#ifdef PARSER_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(phase)
+#define PROFILE_TIMER(name) PhaseTimer name
+#define PROFILE_LAP(name, phase) name.lap(phase)
+#define PROFILE_SENTENCE(timer, len, transitions) \
+  do { if (profiler.enabled) profiler.add_sentence(len, transitions, timer.elapsed_ms()); } while (0)
+#else
+#define PROFILE_SCOPE(phase)
+#define PROFILE_TIMER(name)
+#define PROFILE_LAP(name, phase)
+#define PROFILE_SENTENCE(timer, len, transitions)
+#endif
+
+#endif
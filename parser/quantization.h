@@ -0,0 +1,390 @@
+#ifndef QUANTIZATION_H_
+#define QUANTIZATION_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+// Post-training quantization of the weights used by GreedyDecoder. Matrices
+// and embedding tables can be kept as float32, stored as int8 with one scale
+// per row, or stored as IEEE half precision. Matrices can also be stored as
+// a low-rank product or with pruned columns (see compression.h).
+
+enum WeightType { FLOAT32 = 0, INT8 = 1, FP16 = 2, LOWRANK = 3, PRUNED = 4 };
+
+inline const char* weight_type_name(WeightType t) {
+  switch (t) {
+    case INT8: return "int8";
+    case FP16: return "fp16";
+    case LOWRANK: return "lowrank";
+    case PRUNED: return "pruned";
+    default: return "float32";
+  }
+}
+
+inline bool parse_weight_type(const std::string& s, WeightType* t) {
+  if (s == "float32") *t = FLOAT32;
+  else if (s == "int8") *t = INT8;
+  else if (s == "fp16") *t = FP16;
+  else return false;
+  return true;
+}
+
+// round to nearest even, with overflow to infinity and gradual underflow
+inline uint16_t float_to_half(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  const uint16_t sign = (x >> 16) & 0x8000;
+  const int exp = int((x >> 23) & 0xff) - 127 + 15;
+  uint32_t mant = x & 0x7fffff;
+  if (((x >> 23) & 0xff) == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0);  // inf, nan
+  if (exp >= 31) return sign | 0x7c00;
+  if (exp <= 0) {  // subnormal half
+    if (exp < -10) return sign;
+    mant |= 0x800000;
+    const unsigned shift = 14 - exp;
+    uint32_t h = mant >> shift;
+    const uint32_t rem = mant & ((1u << shift) - 1), half = 1u << (shift - 1);
+    if (rem > half || (rem == half && (h & 1))) ++h;
+    return sign | h;
+  }
+  uint32_t h = (uint32_t(exp) << 10) | (mant >> 13);
+  const uint32_t rem = mant & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) ++h;  // a carry correctly bumps the exponent
+  return sign | h;
+}
+
+inline float half_to_float(uint16_t h) {
+  const uint32_t sign = uint32_t(h & 0x8000) << 16;
+  int exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t x;
+  if (exp == 0) {
+    if (mant == 0) {
+      x = sign;
+    } else {  // normalize the subnormal
+      exp = 1;
+      while (!(mant & 0x400)) { mant <<= 1; --exp; }
+      mant &= 0x3ff;
+      x = sign | (uint32_t(exp + 127 - 15) << 23) | (mant << 13);
+    }
+  } else if (exp == 31) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else {
+    x = sign | (uint32_t(exp + 127 - 15) << 23) | (mant << 13);
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+// every half converted to float, so that converting is one load
+inline const float* half_table() {
+  static const std::vector<float> table = [] {
+    std::vector<float> t(1 << 16);
+    for (unsigned h = 0; h < t.size(); ++h) t[h] = half_to_float(h);
+    return t;
+  }();
+  return table.data();
+}
+
+// converts n halves to floats, 8 at a time with F16C (-march=native on
+// x86), through half_table otherwise
+inline void halves_to_floats(const uint16_t* h, float* f, size_t n) {
+  size_t i = 0;
+#ifdef __F16C__
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(f + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i))));
+#endif
+  const float* table = half_table();
+  for (; i < n; ++i) f[i] = table[h[i]];
+}
+
+// symmetric int8 quantization of n values; returns the scale
+inline float quantize_int8(const float* x, unsigned n, int8_t* q) {
+  float m = 0.f;
+  for (unsigned i = 0; i < n; ++i) m = std::max(m, std::fabs(x[i]));
+  const float scale = m > 0.f ? m / 127.f : 1.f;
+  const float inv = 1.f / scale;
+  for (unsigned i = 0; i < n; ++i) q[i] = int8_t(std::lrint(x[i] * inv));
+  return scale;
+}
+
+template <class T>
+void write_vector(std::ostream& out, const std::vector<T>& v) {
+  const uint64_t n = v.size();
+  out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+  out.write(reinterpret_cast<const char*>(v.data()), n * sizeof(T));
+}
+
+template <class T>
+void read_vector(std::istream& in, std::vector<T>* v) {
+  uint64_t n = 0;
+  in.read(reinterpret_cast<char*>(&n), sizeof(n));
+  v->resize(n);
+  in.read(reinterpret_cast<char*>(v->data()), n * sizeof(T));
+}
+
+inline void write_matrix(std::ostream& out, const Eigen::MatrixXf& m) {
+  const int32_t dims[2] = {int32_t(m.rows()), int32_t(m.cols())};
+  out.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+  out.write(reinterpret_cast<const char*>(m.data()), m.size() * sizeof(float));
+}
+
+inline void read_matrix(std::istream& in, Eigen::MatrixXf* m) {
+  int32_t dims[2] = {0, 0};
+  in.read(reinterpret_cast<char*>(dims), sizeof(dims));
+  m->resize(dims[0], dims[1]);
+  in.read(reinterpret_cast<char*>(m->data()), m->size() * sizeof(float));
+}
+
+inline void read_matrix(std::istream& in, Eigen::VectorXf* v) {
+  Eigen::MatrixXf m;
+  read_matrix(in, &m);
+  *v = m;
+}
+
+// a dense matrix used as y += W x
+struct QuantizedMatrix {
+  QuantizedMatrix() {}
+  QuantizedMatrix(const Eigen::MatrixXf& m) : rows(m.rows()), cols(m.cols()), f(m) {}
+
+  WeightType type = FLOAT32;
+  int rows = 0;
+  int cols = 0;
+  Eigen::MatrixXf f;         // FLOAT32
+  std::vector<int8_t> q;     // INT8, row-major
+  std::vector<float> scale;  // INT8, one per row
+  std::vector<uint16_t> h;   // FP16, row-major
+  Eigen::MatrixXf u, v;      // LOWRANK: W = u * v
+  std::vector<int> kept;     // PRUNED: the columns of W stored (densely) in f
+
+  // converts float32 storage to t (the float copy is released). Without
+  // F16C there is no fast fp16 kernel, so matrices stay float32 (only the
+  // tables are halved).
+  void quantize(WeightType t) {
+    if (type != FLOAT32 || t == FLOAT32) return;
+#ifndef __F16C__
+    if (t == FP16) return;
+#endif
+    Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> rm = f;
+    if (t == INT8) {
+      q.resize(rows * cols);
+      scale.resize(rows);
+      for (int r = 0; r < rows; ++r)
+        scale[r] = quantize_int8(rm.data() + r * cols, cols, q.data() + r * cols);
+    } else {
+      h.resize(rows * cols);
+      for (int i = 0; i < rows * cols; ++i) h[i] = float_to_half(rm.data()[i]);
+    }
+    f.resize(0, 0);
+    type = t;
+  }
+
+  // y += W x. With int8 weights x is quantized on the fly and the dot
+  // products are computed in integer arithmetic (the inner loop multiplies
+  // int8 pairs into an int32 accumulator, which vectorizes well).
+  void gemv(const float* x, float* y) const {
+    if (type == FLOAT32) {
+      Eigen::Map<Eigen::VectorXf>(y, rows).noalias() += f * Eigen::Map<const Eigen::VectorXf>(x, cols);
+    } else if (type == LOWRANK) {
+      static thread_local Eigen::VectorXf t;  // keeps its capacity between calls
+      if (t.size() < v.rows()) t.resize(v.rows());
+      Eigen::Map<Eigen::VectorXf> tv(t.data(), v.rows());
+      tv.noalias() = v * Eigen::Map<const Eigen::VectorXf>(x, cols);
+      Eigen::Map<Eigen::VectorXf>(y, rows).noalias() += u * tv;
+    } else if (type == PRUNED) {
+      static thread_local Eigen::VectorXf t;
+      if (t.size() < int(kept.size())) t.resize(kept.size());
+      Eigen::Map<Eigen::VectorXf> tv(t.data(), kept.size());
+      for (unsigned k = 0; k < kept.size(); ++k) tv[k] = x[kept[k]];
+      Eigen::Map<Eigen::VectorXf>(y, rows).noalias() += f * tv;
+    } else if (type == INT8) {
+      static thread_local std::vector<int8_t> qx;
+      qx.resize(cols);
+      const float sx = quantize_int8(x, cols, qx.data());
+      const int8_t* px = qx.data();
+      for (int r = 0; r < rows; ++r) {
+        const int8_t* pw = q.data() + r * cols;
+        int32_t acc = 0;
+        for (int c = 0; c < cols; ++c) acc += int32_t(pw[c]) * int32_t(px[c]);
+        y[r] += scale[r] * sx * acc;
+      }
+    } else {
+#ifdef __F16C__
+      // fp16: 8 weights converted per instruction, straight into the dot
+      // product. It reads half the bytes of float32, which pays off once the
+      // matrix no longer fits in cache.
+      for (int r = 0; r < rows; ++r) {
+        const uint16_t* pw = h.data() + size_t(r) * cols;
+        __m256 acc = _mm256_setzero_ps();
+        int c = 0;
+        for (; c + 8 <= cols; c += 8) {
+          const __m256 w = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pw + c)));
+          acc = _mm256_add_ps(acc, _mm256_mul_ps(w, _mm256_loadu_ps(x + c)));
+        }
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+        s = _mm_hadd_ps(s, s);
+        s = _mm_hadd_ps(s, s);
+        float tail = _mm_cvtss_f32(s);
+        for (; c < cols; ++c) tail += half_table()[pw[c]] * x[c];
+        y[r] += tail;
+      }
+#else
+      // fp16 matrices from a decoder file written by a build with F16C:
+      // blocks of rows converted to float, then the float kernel
+      typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMat;
+      const int kBlockRows = 32;
+      static thread_local std::vector<float> block;
+      block.resize(size_t(kBlockRows) * cols);
+      Eigen::Map<const Eigen::VectorXf> vx(x, cols);
+      for (int r = 0; r < rows; r += kBlockRows) {
+        const int n = std::min(kBlockRows, rows - r);
+        halves_to_floats(h.data() + size_t(r) * cols, block.data(), size_t(n) * cols);
+        Eigen::Map<Eigen::VectorXf>(y + r, n).noalias() += Eigen::Map<const RowMat>(block.data(), n, cols) * vx;
+      }
+#endif
+    }
+  }
+
+  size_t bytes() const {
+    return f.size() * sizeof(float) + q.size() + scale.size() * sizeof(float) + h.size() * sizeof(uint16_t)
+        + (u.size() + v.size()) * sizeof(float) + kept.size() * sizeof(int);
+  }
+
+  void write(std::ostream& out) const {
+    const int32_t header[3] = {int32_t(type), rows, cols};
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    if (type == FLOAT32 || type == PRUNED) write_matrix(out, f);
+    if (type == LOWRANK) {
+      write_matrix(out, u);
+      write_matrix(out, v);
+    }
+    write_vector(out, kept);
+    write_vector(out, q);
+    write_vector(out, scale);
+    write_vector(out, h);
+  }
+
+  void read(std::istream& in) {
+    int32_t header[3] = {0, 0, 0};
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    type = WeightType(header[0]);
+    rows = header[1];
+    cols = header[2];
+    if (type == FLOAT32 || type == PRUNED) read_matrix(in, &f);
+    if (type == LOWRANK) {
+      read_matrix(in, &u);
+      read_matrix(in, &v);
+    }
+    read_vector(in, &kept);
+    read_vector(in, &q);
+    read_vector(in, &scale);
+    read_vector(in, &h);
+  }
+};
+
+// an embedding table. float32 tables built from a model point into the
+// model's own storage instead of copying it.
+struct QuantizedTable {
+  WeightType type = FLOAT32;
+  unsigned rows = 0;
+  unsigned dim = 0;
+  std::vector<const float*> ref;  // FLOAT32 rows owned by someone else
+  std::vector<float> f;           // FLOAT32 rows owned by the table
+  std::vector<int8_t> q;          // INT8
+  std::vector<float> scale;       // INT8, one per row
+  std::vector<uint16_t> h;        // FP16
+
+  bool empty() const { return rows == 0; }
+
+  const float* float_row(unsigned i) const { return ref.empty() ? f.data() + i * dim : ref[i]; }
+
+  // copies the rows owned by someone else into the table, so that they are
+  // allocated (and first touched) by the calling thread
+  void own() {
+    if (ref.empty()) return;
+    f.resize(size_t(rows) * dim);
+    for (unsigned i = 0; i < rows; ++i) std::memcpy(f.data() + size_t(i) * dim, ref[i], dim * sizeof(float));
+    ref.clear();
+    ref.shrink_to_fit();
+  }
+
+  // writes row i (dequantized) to out[0..dim)
+  void row(unsigned i, float* out) const {
+    assert(i < rows);
+    if (type == FLOAT32) {
+      std::memcpy(out, float_row(i), dim * sizeof(float));
+    } else if (type == INT8) {
+      const int8_t* p = q.data() + i * dim;
+      for (unsigned k = 0; k < dim; ++k) out[k] = scale[i] * p[k];
+    } else {
+      halves_to_floats(h.data() + size_t(i) * dim, out, dim);
+    }
+  }
+
+  void quantize(WeightType t) {
+    if (type != FLOAT32 || t == FLOAT32) return;
+    if (t == INT8) {
+      q.resize(rows * dim);
+      scale.resize(rows);
+      for (unsigned i = 0; i < rows; ++i)
+        scale[i] = quantize_int8(float_row(i), dim, q.data() + i * dim);
+    } else {
+      h.resize(rows * dim);
+      for (unsigned i = 0; i < rows; ++i)
+        for (unsigned k = 0; k < dim; ++k) h[i * dim + k] = float_to_half(float_row(i)[k]);
+    }
+    ref.clear();
+    f.clear();
+    f.shrink_to_fit();
+    type = t;
+  }
+
+  // bytes owned by the table
+  size_t bytes() const {
+    return ref.size() * sizeof(float*) + f.size() * sizeof(float) + q.size()
+        + scale.size() * sizeof(float) + h.size() * sizeof(uint16_t);
+  }
+
+  void write(std::ostream& out) const {
+    const int32_t header[3] = {int32_t(type), int32_t(rows), int32_t(dim)};
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    if (type == FLOAT32)
+      for (unsigned i = 0; i < rows; ++i)
+        out.write(reinterpret_cast<const char*>(float_row(i)), dim * sizeof(float));
+    write_vector(out, q);
+    write_vector(out, scale);
+    write_vector(out, h);
+  }
+
+  void read(std::istream& in) {
+    int32_t header[3] = {0, 0, 0};
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    type = WeightType(header[0]);
+    rows = header[1];
+    dim = header[2];
+    ref.clear();
+    f.clear();
+    if (type == FLOAT32) {
+      f.resize(size_t(rows) * dim);
+      in.read(reinterpret_cast<char*>(f.data()), f.size() * sizeof(float));
+    }
+    read_vector(in, &q);
+    read_vector(in, &scale);
+    read_vector(in, &h);
+  }
+};
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef SPARSE_TRAINER_H_
+#define SPARSE_TRAINER_H_
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "cnn/cnn.h"
+#include "cnn/training.h"
+
+// Weight decay for the rows of the lookup tables, applied lazily. Every
+// update multiplies every parameter by (1 - lambda), as SimpleSGDTrainer
+// does for the rows it updates; a row that was not touched for k updates
+// gets the k factors at once when it is next touched (or flushed), so an
+// update only costs as much as the rows in it.
+class LazyDecay {
+ public:
+  explicit LazyDecay(float lambda) : lambda(lambda) {}
+
+  // brings a row up to date with the previous updates, before the current
+  // update applies its own decay to it
+  void catch_up(const cnn::LookupParameters* p, unsigned row, float* v, unsigned size) {
+    std::vector<unsigned>& last = rows_of(p);
+    const unsigned missed = step - last[row];
+    if (missed && lambda > 0) {
+      const float f = std::pow(1.f - lambda, float(missed));
+      for (unsigned i = 0; i < size; ++i) v[i] *= f;
+    }
+    last[row] = step + 1;
+  }
+
+  // call at the end of every update
+  void end_update() { ++step; }
+
+  // applies the pending decay to every row of every table, e.g. before the
+  // model is evaluated or saved
+  void flush(const std::vector<cnn::LookupParameters*>& tables) {
+    for (auto p : tables) {
+      std::vector<unsigned>& last = rows_of(p);
+      for (unsigned row = 0; row < p->values.size(); ++row) {
+        const unsigned missed = step - last[row];
+        if (missed && lambda > 0) {
+          Eigen::Map<Eigen::VectorXf> v(p->values[row].v, p->values[row].d.size());
+          v *= std::pow(1.f - lambda, float(missed));
+        }
+        last[row] = step;
+      }
+    }
+  }
+
+  size_t bytes() const {
+    size_t b = 0;
+    for (auto& r : last_update) b += r.second.capacity() * sizeof(unsigned);
+    return b;
+  }
+
+ private:
+  std::vector<unsigned>& rows_of(const cnn::LookupParameters* p) {
+    std::vector<unsigned>& last = last_update[p];
+    if (last.size() < p->values.size()) last.resize(p->values.size(), step);
+    return last;
+  }
+
+  const float lambda;
+  unsigned step = 0;  // updates done
+  std::unordered_map<const cnn::LookupParameters*, std::vector<unsigned>> last_update;  // by row
+};
+
+// The parser's trainer: SGD, momentum, AdaGrad or Adam with sparse updates
+// of the lookup tables. Only the rows with a gradient are read and written
+// (and their gradients cleared), and their weight decay is applied lazily;
+// with momentum, AdaGrad and Adam the state of the other rows is left as it
+// is until they are next used. The dense parameters are updated as in the
+// corresponding cnn trainers. With SGD the updates are exactly those of
+// SimpleSGDTrainer. Call flush() before using the parameters for anything
+// else than training. Fixed tables (read with const_lookup, such as the
+// pretrained embeddings) get no gradients, so they are neither updated nor
+// decayed.
+class SparseTrainer : public cnn::Trainer {
+ public:
+  enum Rule { SGD, MOMENTUM, ADAGRAD, ADAM };
+
+  static bool parse_rule(const std::string& s, Rule* rule) {
+    if (s == "sgd") *rule = SGD;
+    else if (s == "momentum") *rule = MOMENTUM;
+    else if (s == "adagrad") *rule = ADAGRAD;
+    else if (s == "adam") *rule = ADAM;
+    else return false;
+    return true;
+  }
+  static const char* rule_name(Rule rule) {
+    static const char* names[] = {"sgd", "momentum", "adagrad", "adam"};
+    return names[rule];
+  }
+  // the usual initial learning rate of each rule
+  static float default_eta0(Rule rule) { return rule == ADAM ? 0.001 : rule == MOMENTUM ? 0.01 : 0.1; }
+
+  SparseTrainer(cnn::Model* m, Rule rule, cnn::real lam = 1e-6, cnn::real e0 = 0.1,
+                const std::unordered_set<const cnn::LookupParameters*>& fixed = {}) :
+      cnn::Trainer(m, lam, e0), rule(rule), decay(lam), fixed(fixed) {
+    flush();  // registers every row as up to date
+  }
+
+  void update(cnn::real scale) override {
+    const float gscale = clip_gradients();
+    const float lr = eta * scale * gscale;
+    ++t;
+    state.resize(model->parameters_list().size() + model->lookup_parameters_list().size());
+    unsigned k = 0;
+    for (auto p : model->parameters_list()) {
+      const unsigned size = p->values.d.size();
+      std::vector<float>& s = state[k++];
+      if (s.size() < size * slots()) s.resize(size * slots());
+      step(p->values.v, p->g.v, s.empty() ? nullptr : &s[0], size, lr);
+    }
+    for (auto p : model->lookup_parameters_list()) {
+      std::vector<float>& table = state[k++];
+      if (fixed.count(p)) continue;
+      for (auto row : p->non_zero_grads) {
+        const unsigned size = p->values[row].d.size();
+        if (table.size() < p->values.size() * size * slots()) table.resize(p->values.size() * size * slots());
+        decay.catch_up(p, row, p->values[row].v, size);
+        step(p->values[row].v, p->grads[row].v, table.empty() ? nullptr : &table[row * size * slots()], size, lr);
+      }
+      p->non_zero_grads.clear();
+    }
+    decay.end_update();
+    ++updates;
+  }
+
+  void flush() {
+    std::vector<cnn::LookupParameters*> tables;
+    for (auto p : model->lookup_parameters_list())
+      if (!fixed.count(p)) tables.push_back(p);
+    decay.flush(tables);
+  }
+
+  // the optimizer state, by parameter then lookup table in model order (for
+  // checkpoints); the lookup tables must be flushed
+  void save_state(std::vector<std::vector<float>>* out, uint64_t* steps) const { *out = state; *steps = t; }
+  void restore_state(const std::vector<std::vector<float>>& in, uint64_t steps) { state = in; t = steps; }
+
+  const Rule rule;
+  float momentum = 0.9;
+  float beta1 = 0.9, beta2 = 0.999;
+  float epsilon = 1e-8;
+  LazyDecay decay;
+
+ private:
+  // floats of state per weight
+  unsigned slots() const { return rule == SGD ? 0 : rule == ADAM ? 2 : 1; }
+
+  // v -= delta + lambda * v, where delta is computed from the gradient g
+  // (which is cleared) and the state s of the weights
+  void step(float* v_, float* g_, float* s_, unsigned size, float lr) {
+    typedef Eigen::Map<Eigen::ArrayXf> A;
+    A v(v_, size), g(g_, size);
+    switch (rule) {
+      case SGD:
+        v -= lr * g + lambda * v;
+        break;
+      case MOMENTUM: {
+        A m(s_, size);
+        m = momentum * m + lr * g;
+        v -= m + lambda * v;
+        break;
+      }
+      case ADAGRAD: {
+        A s(s_, size);
+        s += g.square();
+        v -= lr * g / (s.sqrt() + epsilon) + lambda * v;
+        break;
+      }
+      case ADAM: {
+        A m(s_, size), s(s_ + size, size);
+        m = beta1 * m + (1 - beta1) * g;
+        s = beta2 * s + (1 - beta2) * g.square();
+        const float c1 = 1 - std::pow(beta1, float(t)), c2 = 1 - std::pow(beta2, float(t));
+        v -= lr * (m / c1) / ((s / c2).sqrt() + epsilon) + lambda * v;
+        break;
+      }
+    }
+    g.setZero();
+  }
+
+  const std::unordered_set<const cnn::LookupParameters*> fixed;
+  uint64_t t = 0;  // updates, for Adam's bias correction
+  std::vector<std::vector<float>> state;  // by parameter, then lookup table
+};
+
+#endif
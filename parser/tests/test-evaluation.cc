@@ -0,0 +1,92 @@
+#define BOOST_TEST_MODULE evaluation
+#include <boost/test/included/unit_test.hpp>
+
+#include <sstream>
+
+#include "evaluation.h"
+
+using namespace std;
+
+static const vector<string> kActions = {"SHIFT", "SWAP", "LEFT-ARC(nsubj)", "RIGHT-ARC(obj)", "LEFT-ARC(root)"};
+enum { SH, SW, L_NSUBJ, R_OBJ, L_ROOT };
+
+BOOST_AUTO_TEST_CASE(action_table) {
+  ActionTable table(kActions);
+  BOOST_CHECK_EQUAL(table.kind(SH), ActionTable::SHIFT);
+  BOOST_CHECK_EQUAL(table.kind(SW), ActionTable::SWAP);
+  BOOST_CHECK_EQUAL(table.kind(L_NSUBJ), ActionTable::LEFT);
+  BOOST_CHECK_EQUAL(table.kind(R_OBJ), ActionTable::RIGHT);
+  BOOST_CHECK_EQUAL(table.rel(SH), -1);
+  BOOST_CHECK_EQUAL(table.nrels(), 3u);
+  BOOST_CHECK_EQUAL(table.rel_name(table.rel(L_ROOT)), "root");
+}
+
+// "a b c" ROOT, with b the root and a, c its dependents
+BOOST_AUTO_TEST_CASE(compute_heads_projective) {
+  ActionTable table(kActions);
+  vector<int> heads, rels;
+  compute_heads(4, {SH, SH, L_NSUBJ, SH, R_OBJ, SH, L_ROOT}, table, &heads, &rels);
+  BOOST_CHECK(heads == vector<int>({1, 3, 1, -1}));
+  BOOST_CHECK(rels == vector<int>({table.rel(L_NSUBJ), table.rel(L_ROOT), table.rel(R_OBJ), -1}));
+}
+
+// w2 -> w0 and w3 -> w1 cross, so the oracle swaps w0 and w1
+BOOST_AUTO_TEST_CASE(compute_heads_swap) {
+  ActionTable table(kActions);
+  vector<int> heads, rels;
+  compute_heads(5, {SH, SH, SW, SH, SH, L_NSUBJ, SH, L_NSUBJ, L_NSUBJ, SH, L_ROOT}, table, &heads, &rels);
+  BOOST_CHECK(heads == vector<int>({2, 3, 3, 4, -1}));
+  BOOST_CHECK_EQUAL(rels[3], table.rel(L_ROOT));
+}
+
+BOOST_AUTO_TEST_CASE(punctuation) {
+  BOOST_CHECK(is_punctuation(","));
+  BOOST_CHECK(is_punctuation("..."));
+  BOOST_CHECK(is_punctuation("\xe2\x80\x94"));  // em dash
+  BOOST_CHECK(is_punctuation("\xe3\x80\x82"));  // CJK full stop
+  BOOST_CHECK(!is_punctuation(""));
+  BOOST_CHECK(!is_punctuation("a."));
+  BOOST_CHECK(!is_punctuation("\xc3\xa9"));
+}
+
+BOOST_AUTO_TEST_CASE(scores) {
+  Evaluation eval;
+  // the third word is punctuation, and attached to the wrong head
+  eval.add({1, 3, 1, -1}, {0, 2, 1, -1}, {1, 3, 2, -1}, {0, 1, 1, -1}, {false, false, true});
+  BOOST_CHECK_EQUAL(eval.tokens(), 3u);
+  BOOST_CHECK_EQUAL(eval.correct_heads(), 2u);
+  BOOST_CHECK_CLOSE(eval.uas(), 2. / 3, 1e-9);
+  BOOST_CHECK_CLOSE(eval.las(), 1. / 3, 1e-9);
+  BOOST_CHECK_CLOSE(eval.uas_nopunct(), 1., 1e-9);
+  BOOST_CHECK_CLOSE(eval.las_nopunct(), 0.5, 1e-9);
+}
+
+// evaluations of parts of a data set merge into that of the whole set
+BOOST_AUTO_TEST_CASE(merge_parts) {
+  struct Sentence { vector<int> gold_heads, gold_rels, heads, rels; vector<bool> punct; };
+  vector<Sentence> data = {
+    {{1, 3, 1, -1}, {0, 2, 1, -1}, {1, 3, 2, -1}, {0, 1, 1, -1}, {false, false, true}},
+    {{1, 2, -1}, {0, 2, -1}, {1, 2, -1}, {0, 2, -1}, {}},
+    {{4, 0, 4, 2, 5, -1}, {0, 1, 0, 1, 2, -1}, {4, 4, 4, 2, 5, -1}, {0, 1, 1, 1, 2, -1}, {false, true, false, false, false}},
+  };
+  Evaluation whole, first, rest;
+  for (unsigned i = 0; i < data.size(); ++i) {
+    const Sentence& s = data[i];
+    whole.add(s.gold_heads, s.gold_rels, s.heads, s.rels, s.punct);
+    (i == 0 ? first : rest).add(s.gold_heads, s.gold_rels, s.heads, s.rels, s.punct);
+  }
+  Evaluation merged;
+  merged.merge(rest);
+  merged.merge(first);
+  BOOST_CHECK_EQUAL(merged.tokens(), whole.tokens());
+  BOOST_CHECK_EQUAL(merged.correct_heads(), whole.correct_heads());
+  BOOST_CHECK_EQUAL(merged.uas(), whole.uas());
+  BOOST_CHECK_EQUAL(merged.las(), whole.las());
+  BOOST_CHECK_EQUAL(merged.uas_nopunct(), whole.uas_nopunct());
+  BOOST_CHECK_EQUAL(merged.las_nopunct(), whole.las_nopunct());
+  ActionTable table(kActions);
+  ostringstream a, b;
+  merged.report(a, table);
+  whole.report(b, table);
+  BOOST_CHECK_EQUAL(a.str(), b.str());
+}
@@ -0,0 +1,100 @@
+#define BOOST_TEST_MODULE formats
+#include <boost/test/included/unit_test.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "distillation.h"
+#include "parse-trace.h"
+
+using namespace std;
+
+static string read_file(const string& fname) {
+  ifstream in(fname.c_str(), ios_base::in | ios_base::binary);
+  ostringstream s;
+  s << in.rdbuf();
+  return s.str();
+}
+
+static void write_file(const string& fname, const string& data) {
+  ofstream out(fname.c_str(), ios_base::out | ios_base::binary);
+  out << data;
+}
+
+BOOST_AUTO_TEST_CASE(trace_round_trip) {
+  const string fname = "test-formats.trace";
+  const vector<string> words1 = {"the", "dog", "saw", "the", "cat"}, tags1 = {"DT", "NN", "VBD", "DT", "NN"};
+  const vector<string> words2 = {"dog", "", string(300, 'x')}, tags2 = {"NN", "NN", "FW"};
+  {
+    TraceWriter w(fname);
+    const TraceWriter::Clock::time_point now = TraceWriter::Clock::now();
+    const auto us = [](int n) { return std::chrono::microseconds(n); };
+    // recorded out of order: read_trace sorts by arrival
+    w.add(now + us(5000), now + us(5700), words1.size(), [&](unsigned i) { return words1[i]; },
+          [&](unsigned i) { return tags1[i]; });
+    w.add(now + us(1000), now + us(1500), words2.size(), [&](unsigned i) { return words2[i]; },
+          [&](unsigned i) { return tags2[i]; });
+    BOOST_CHECK_EQUAL(w.records, 2u);
+    BOOST_CHECK(w.good());
+  }
+  vector<TraceRecord> records;
+  BOOST_REQUIRE(read_trace(fname, &records));
+  BOOST_REQUIRE_EQUAL(records.size(), 2u);
+  BOOST_CHECK(records[0].words == words2 && records[0].tags == tags2);
+  BOOST_CHECK(records[1].words == words1 && records[1].tags == tags1);
+  BOOST_CHECK_EQUAL(records[0].latency_us, 500u);
+  BOOST_CHECK_EQUAL(records[1].latency_us, 700u);
+  BOOST_CHECK_EQUAL(records[1].arrival_us - records[0].arrival_us, 4000u);
+
+  const string data = read_file(fname);
+  write_file(fname, data.substr(0, data.size() - 3));
+  BOOST_CHECK(!read_trace(fname, &records));  // truncated
+  write_file(fname, "LSTMTRC0" + data.substr(8));
+  BOOST_CHECK(!read_trace(fname, &records));
+  BOOST_CHECK(!read_trace("test-formats.missing", &records));
+  remove(fname.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(soft_targets) {
+  const float adist[] = {log(0.1f), log(0.05f), log(0.5f), log(0.3f), log(0.05f)};
+  SoftTargets t;
+  t.add_step(adist, {0, 2, 3, 4}, 2);  // action 1 is not valid
+  t.add_step(adist, {1, 4}, 8);
+  BOOST_REQUIRE_EQUAL(t.steps(), 2u);
+  vector<pair<unsigned, float>> out;
+  t.targets(0, 1, &out);
+  BOOST_REQUIRE_EQUAL(out.size(), 2u);
+  BOOST_CHECK_EQUAL(out[0].first, 2u);
+  BOOST_CHECK_EQUAL(out[1].first, 3u);
+  BOOST_CHECK_CLOSE(out[0].second, 0.5 / 0.8, 0.1);  // renormalized over the kept actions
+  BOOST_CHECK_CLOSE(out[1].second, 0.3 / 0.8, 0.1);
+  t.targets(0, 2, &out);  // softer: sqrt(0.5) : sqrt(0.3)
+  BOOST_CHECK_CLOSE(out[0].second / out[1].second, sqrt(0.5 / 0.3), 0.1);
+  t.targets(1, 1, &out);
+  BOOST_REQUIRE_EQUAL(out.size(), 2u);
+  BOOST_CHECK_CLOSE(out[0].second, 0.5, 0.1);
+}
+
+BOOST_AUTO_TEST_CASE(soft_targets_round_trip) {
+  const string fname = "test-formats.soft";
+  const float adist[] = {-0.1f, -3.5f, -2.25f, -7.f};
+  vector<SoftTargets> all(3);
+  all[0].add_step(adist, {0, 1, 2, 3}, 3);
+  all[0].add_step(adist, {1, 3}, 3);
+  all[2].add_step(adist, {3}, 3);
+  BOOST_REQUIRE(save_soft_targets(fname, 42, all));
+  vector<SoftTargets> loaded;
+  BOOST_REQUIRE(load_soft_targets(fname, 42, &loaded));
+  BOOST_REQUIRE_EQUAL(loaded.size(), all.size());
+  for (unsigned i = 0; i < all.size(); ++i) {
+    BOOST_CHECK(loaded[i].offsets == all[i].offsets);
+    BOOST_CHECK(loaded[i].actions == all[i].actions);
+    BOOST_CHECK(loaded[i].logp == all[i].logp);
+  }
+  BOOST_CHECK(!load_soft_targets(fname, 43, &loaded));  // another teacher or oracle
+  const string data = read_file(fname);
+  write_file(fname, data.substr(0, data.size() - 1));
+  BOOST_CHECK(!load_soft_targets(fname, 42, &loaded));
+  remove(fname.c_str());
+}
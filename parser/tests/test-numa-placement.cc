@@ -0,0 +1,25 @@
+#define BOOST_TEST_MODULE numa_placement
+#include <boost/test/included/unit_test.hpp>
+
+#include "numa-placement.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(parse_cpulist) {
+  BOOST_CHECK(NumaTopology::parse_cpulist("0-3,8,10-11") == vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  BOOST_CHECK(NumaTopology::parse_cpulist("5") == vector<int>({5}));
+  BOOST_CHECK(NumaTopology::parse_cpulist("2-3\n") == vector<int>({2, 3}));
+  BOOST_CHECK(NumaTopology::parse_cpulist("").empty());
+  BOOST_CHECK(NumaTopology::parse_cpulist("4-2").empty());
+}
+
+BOOST_AUTO_TEST_CASE(round_robin) {
+  NumaTopology topology;
+  topology.node_cpus = {{0, 1, 2}, {4, 5}};
+  BOOST_CHECK_EQUAL(topology.nodes(), 2u);
+  const int expected[] = {0, 4, 1, 5, 2, 4, 0};
+  for (unsigned t = 0; t < 7; ++t) {
+    BOOST_CHECK_EQUAL(topology.node_of_thread(t), t % 2);
+    BOOST_CHECK_EQUAL(topology.cpu_of_thread(t), expected[t]);
+  }
+}
@@ -0,0 +1,103 @@
+#define BOOST_TEST_MODULE parse_writer
+#include <boost/test/included/unit_test.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <boost/iostreams/copy.hpp>
+
+#include "parse-writer.h"
+
+using namespace std;
+
+static const vector<string> kActions = {"SHIFT", "SWAP", "LEFT-ARC(nsubj)", "RIGHT-ARC(obj)", "LEFT-ARC(root)"};
+// "a b c" with b the root, as compute_heads returns it (ROOT at position 3)
+static const vector<string> kForms = {"a", "b\"q", "c"}, kTags = {"D", "N", "V"};
+static const vector<int> kHeads = {1, 3, 1, -1}, kRels = {0, 2, 1, -1};
+
+static string read_file(const string& fname) {
+  ifstream in(fname.c_str(), ios_base::in | ios_base::binary);
+  ostringstream s;
+  s << in.rdbuf();
+  return s.str();
+}
+
+// writes the sentence twice, the second time as degraded
+static string write_twice(ParseWriter::Format format, const string& fname = "test-parse-writer.out",
+                          size_t block_bytes = 1 << 20) {
+  ActionTable table(kActions);
+  {
+    ParseWriter w(fname, format, table, block_bytes);
+    auto form = [](unsigned i) { return kForms[i]; };
+    auto tag = [](unsigned i) { return kTags[i]; };
+    w.write(3, form, tag, kHeads, kRels);
+    w.write(3, form, tag, kHeads, kRels, true);
+    BOOST_CHECK_EQUAL(w.sentences, 2u);
+    BOOST_CHECK(w.close());
+  }
+  const string data = read_file(fname);
+  remove(fname.c_str());
+  return data;
+}
+
+static const string kConll =
+    "1\ta\t_\t_\tD\t_\t2\tnsubj\t_\t_\n"
+    "2\tb\"q\t_\t_\tN\t_\t0\troot\t_\t_\n"
+    "3\tc\t_\t_\tV\t_\t2\tobj\t_\t_\n"
+    "\n";
+
+BOOST_AUTO_TEST_CASE(parse_format) {
+  ParseWriter::Format f = ParseWriter::CONLLX;
+  BOOST_CHECK(ParseWriter::parse_format("jsonl", &f) && f == ParseWriter::JSONL);
+  BOOST_CHECK(ParseWriter::parse_format("binary", &f) && f == ParseWriter::BINARY);
+  BOOST_CHECK(!ParseWriter::parse_format("conll", &f));
+}
+
+// CoNLL-X readers would take a comment for a malformed token line
+BOOST_AUTO_TEST_CASE(conllx) {
+  BOOST_CHECK_EQUAL(write_twice(ParseWriter::CONLLX), kConll + kConll);
+}
+
+BOOST_AUTO_TEST_CASE(conllu) {
+  BOOST_CHECK_EQUAL(write_twice(ParseWriter::CONLLU), kConll + "# degraded = true\n" + kConll);
+}
+
+BOOST_AUTO_TEST_CASE(jsonl) {
+  const string json = "{\"words\": [\"a\", \"b\\\"q\", \"c\"], \"tags\": [\"D\", \"N\", \"V\"], "
+                      "\"heads\": [2, 0, 2], \"deprels\": [\"nsubj\", \"root\", \"obj\"]";
+  BOOST_CHECK_EQUAL(write_twice(ParseWriter::JSONL), json + "}\n" + json + ", \"degraded\": true}\n");
+}
+
+BOOST_AUTO_TEST_CASE(binary) {
+  string expected("LSTMPRS2\x03\0\0\0", 12);
+  for (const char* rel : {"nsubj", "obj", "root"}) {
+    expected += string(1, char(strlen(rel))) + string(3, '\0');
+    expected += rel;
+  }
+  const string sentence("\x02\0\0\0" "\0\0\x02\0" "\x02\0\x01\0", 12);  // (head, relation) per word
+  expected += string("\x03\0\0\0", 4) + sentence;
+  expected += string("\x03\0\0\x80", 4) + sentence;
+  BOOST_CHECK(write_twice(ParseWriter::BINARY) == expected);
+}
+
+BOOST_AUTO_TEST_CASE(unbuffered) {
+  BOOST_CHECK_EQUAL(write_twice(ParseWriter::CONLLU, "test-parse-writer.out", 0), kConll + "# degraded = true\n" + kConll);
+}
+
+BOOST_AUTO_TEST_CASE(gzip) {
+  istringstream compressed(write_twice(ParseWriter::JSONL, "test-parse-writer.out.gz"));
+  boost::iostreams::filtering_istream in;
+  in.push(boost::iostreams::gzip_decompressor());
+  in.push(compressed);
+  ostringstream text;
+  boost::iostreams::copy(in, text);
+  BOOST_CHECK_EQUAL(text.str(), write_twice(ParseWriter::JSONL));
+}
+
+BOOST_AUTO_TEST_CASE(unwritable) {
+  ActionTable table(kActions);
+  ParseWriter w("no-such-directory/out.conll", ParseWriter::CONLLX, table);
+  w.write(3, [](unsigned i) { return kForms[i]; }, [](unsigned i) { return kTags[i]; }, kHeads, kRels);
+  BOOST_CHECK(!w.close());
+}
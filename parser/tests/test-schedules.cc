@@ -0,0 +1,127 @@
+#define BOOST_TEST_MODULE schedules
+#include <boost/test/included/unit_test.hpp>
+
+#include "dev-schedule.h"
+#include "lr-schedule.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_CASE(lr_schedule_parse) {
+  LRSchedule s;
+  for (const char* bad : {"", "bogus", "inverse", "constant:1", "step:2", "step:0:0.5", "cosine:0",
+                          "plateau:0.5:0", "inverse:0.1x"})
+    BOOST_CHECK_MESSAGE(!LRSchedule::parse(bad, &s), bad);
+  BOOST_CHECK_EQUAL(s.str(), "inverse:0.08");  // unchanged by the failures
+  BOOST_CHECK(LRSchedule::parse("step:2:0.1", &s));
+  BOOST_CHECK_EQUAL(s.str(), "step:2:0.1");
+}
+
+BOOST_AUTO_TEST_CASE(lr_schedule_rate) {
+  LRSchedule s;
+  BOOST_CHECK(LRSchedule::parse("inverse:0.5", &s));
+  BOOST_CHECK_CLOSE(s.rate(1, 2.7), 0.5, 1e-4);  // completed epochs only
+  BOOST_CHECK(LRSchedule::parse("constant", &s));
+  BOOST_CHECK_CLOSE(s.rate(0.1, 7), 0.1, 1e-4);
+  BOOST_CHECK(LRSchedule::parse("step:2:0.1", &s));
+  BOOST_CHECK_CLOSE(s.rate(1, 1.9), 1, 1e-4);
+  BOOST_CHECK_CLOSE(s.rate(1, 3.9), 0.1, 1e-4);
+  BOOST_CHECK_CLOSE(s.rate(1, 4), 0.01, 1e-4);
+  BOOST_CHECK(LRSchedule::parse("cosine:10", &s));
+  BOOST_CHECK_CLOSE(s.rate(1, 0), 1, 1e-4);
+  BOOST_CHECK_CLOSE(s.rate(1, 5), 0.5, 1e-4);
+  BOOST_CHECK_SMALL(s.rate(1, 20), 1e-6f);
+  BOOST_CHECK(LRSchedule::parse("constant", &s));
+  s.warmup = 2;
+  BOOST_CHECK_CLOSE(s.rate(1, 0.5), 0.25, 1e-4);
+  BOOST_CHECK_CLOSE(s.rate(1, 3), 1, 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(lr_schedule_plateau) {
+  LRSchedule s;
+  BOOST_CHECK(LRSchedule::parse("plateau:0.5:2", &s));
+  s.dev_score(0.8);
+  s.dev_score(0.7);
+  BOOST_CHECK_CLOSE(s.rate(1, 1), 1, 1e-4);
+  s.dev_score(0.8);  // no better than the best
+  BOOST_CHECK_CLOSE(s.rate(1, 1), 0.5, 1e-4);
+  s.dev_score(0.9);
+  s.dev_score(0.85);
+  BOOST_CHECK_EQUAL(s.bad_evals, 1u);
+  BOOST_CHECK_EQUAL(s.best_uas, 0.9);
+  BOOST_CHECK_CLOSE(s.rate(1, 1), 0.5, 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(dev_schedule_parse) {
+  DevSchedule s;
+  for (const char* bad : {"", "blocks", "blocks:0", "blocks:-1", "minutes:x", "sentences:10:2", "epochs:1"})
+    BOOST_CHECK_MESSAGE(!DevSchedule::parse(bad, &s), bad);
+  BOOST_CHECK_EQUAL(s.str(), "blocks:25");
+  BOOST_CHECK(DevSchedule::parse("minutes:0.5", &s));
+  BOOST_CHECK_EQUAL(s.str(), "minutes:0.5");
+}
+
+BOOST_AUTO_TEST_CASE(dev_schedule_due) {
+  DevSchedule s;
+  BOOST_CHECK(DevSchedule::parse("blocks:3", &s));
+  BOOST_CHECK(s.due(1, 0, 0));
+  BOOST_CHECK(!s.due(2, 0, 0));
+  BOOST_CHECK(!s.due(3, 0, 0));
+  BOOST_CHECK(s.due(4, 0, 0));
+  BOOST_CHECK(DevSchedule::parse("blocks:1", &s));
+  BOOST_CHECK(s.due(1, 0, 0) && s.due(2, 0, 0));
+
+  BOOST_CHECK(DevSchedule::parse("sentences:100", &s));
+  BOOST_CHECK(s.due(1, 10, 0));  // nothing evaluated yet
+  s.evaluated(10, 0);
+  BOOST_CHECK(!s.due(2, 109, 0));
+  BOOST_CHECK(s.due(2, 110, 0));
+
+  BOOST_CHECK(DevSchedule::parse("minutes:2", &s));
+  s.evaluated(0, 10);
+  BOOST_CHECK(!s.due(1, 0, 129));
+  BOOST_CHECK(s.due(1, 0, 130));
+}
+
+BOOST_AUTO_TEST_CASE(dev_schedule_best_sample) {
+  DevSchedule s;
+  BOOST_CHECK(s.likely_new_best(0.1, 100));  // nothing seen yet
+  s.sample_score(0.9);
+  s.sample_score(0.8);
+  BOOST_CHECK_EQUAL(s.best_sample_uas, 0.9);
+  BOOST_CHECK(s.likely_new_best(0.91, 100));
+  BOOST_CHECK(s.likely_new_best(0.89, 100));     // within one standard error (0.031)
+  BOOST_CHECK(!s.likely_new_best(0.89, 100000));  // not with a standard error of 0.001
+}
+
+BOOST_AUTO_TEST_CASE(stratified_sample) {
+  vector<unsigned> lengths(100);
+  for (unsigned i = 0; i < lengths.size(); ++i) lengths[i] = (i * 37) % 100;  // a permutation of 0..99
+  vector<unsigned> sample = stratified_dev_sample(lengths, 10);
+  BOOST_CHECK_EQUAL(sample.size(), 10u);
+  BOOST_CHECK(is_sorted(sample.begin(), sample.end()));
+  vector<unsigned> deciles;
+  for (unsigned i : sample) deciles.push_back(lengths[i] / 10);
+  sort(deciles.begin(), deciles.end());
+  for (unsigned k = 0; k < 10; ++k) BOOST_CHECK_EQUAL(deciles[k], k);  // one sentence per stratum
+  BOOST_CHECK(stratified_dev_sample(lengths, 10) == sample);  // the same in every run
+  BOOST_CHECK_EQUAL(stratified_dev_sample(lengths, 0).size(), 100u);
+  BOOST_CHECK_EQUAL(stratified_dev_sample(lengths, 200).size(), 100u);
+}
+
+BOOST_AUTO_TEST_CASE(early_stopping) {
+  EarlyStopping s(2, 1, 0.01);
+  BOOST_CHECK(!s.add(0.5));
+  BOOST_CHECK(!s.add(0.6));
+  BOOST_CHECK(!s.add(0.605));  // within min_delta
+  BOOST_CHECK(s.add(0.55));
+  BOOST_CHECK(s.stop());
+
+  EarlyStopping windowed(1, 2, 0);
+  BOOST_CHECK(!windowed.add(0.5));
+  BOOST_CHECK(!windowed.add(0.7));  // average 0.6
+  BOOST_CHECK(windowed.add(0.5));   // average 0.6 again
+  BOOST_CHECK(windowed.recent == vector<double>({0.7, 0.5}));
+
+  EarlyStopping off(0, 1, 0);
+  for (int i = 0; i < 10; ++i) BOOST_CHECK(!off.add(0.5));
+}
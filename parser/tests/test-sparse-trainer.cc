@@ -0,0 +1,47 @@
+#define BOOST_TEST_MODULE sparse_trainer
+#include <boost/test/included/unit_test.hpp>
+
+#include <cmath>
+#include <cstring>
+
+#include "cnn/cnn.h"
+#include "sparse-trainer.h"
+
+using namespace std;
+
+struct CnnSetup {
+  CnnSetup() {
+    int argc = 1;
+    char arg0[] = "test-sparse-trainer";
+    char* args[] = {arg0, nullptr};
+    char** argv = args;
+    cnn::Initialize(argc, argv, 1);
+  }
+};
+BOOST_GLOBAL_FIXTURE(CnnSetup);
+
+static vector<float> values(const cnn::LookupParameters* p) {
+  vector<float> v;
+  for (auto& row : p->values) v.insert(v.end(), row.v, row.v + row.d.size());
+  return v;
+}
+
+// the pretrained embeddings are read with const_lookup and never get
+// gradients: flushing the lazy weight decay must leave them untouched
+BOOST_AUTO_TEST_CASE(fixed_tables_are_not_decayed) {
+  cnn::Model model;
+  cnn::LookupParameters* learned = model.add_lookup_parameters(5, cnn::Dim(4, 1));
+  cnn::LookupParameters* fixed = model.add_lookup_parameters(5, cnn::Dim(4, 1));
+  fixed->Initialize(2, {1, 2, 3, 4});
+  const vector<float> learned_before = values(learned), fixed_before = values(fixed);
+  SparseTrainer sgd(&model, SparseTrainer::SGD, 0.1, 0.1, {fixed});
+  for (int i = 0; i < 3; ++i) sgd.update(1);
+  sgd.flush();
+  sgd.flush();  // nothing left to apply
+  const vector<float> fixed_after = values(fixed);
+  BOOST_REQUIRE_EQUAL(fixed_after.size(), fixed_before.size());
+  BOOST_CHECK(memcmp(fixed_after.data(), fixed_before.data(), fixed_before.size() * sizeof(float)) == 0);
+  const vector<float> learned_after = values(learned);
+  for (unsigned i = 0; i < learned_before.size(); ++i)
+    BOOST_CHECK_CLOSE(learned_after[i], learned_before[i] * pow(0.9f, 3.f), 1e-3);
+}
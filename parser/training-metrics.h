@@ -0,0 +1,136 @@
+#ifndef TRAINING_METRICS_H_
+#define TRAINING_METRICS_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+// resident set size of this process, from /proc/self/statm (0 elsewhere)
+inline size_t resident_bytes() {
+  std::ifstream in("/proc/self/statm");
+  size_t pages = 0, resident = 0;
+  if (!(in >> pages >> resident)) return 0;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Training progress for dashboards. The training loop updates the counters
+// and write() dumps them to a file, either in the Prometheus text format
+// (the file is replaced atomically, for the node exporter's textfile
+// collector) or as JSON lines (one line is appended per dump).
+class TrainingMetrics {
+ public:
+  TrainingMetrics(const std::string& fname, bool jsonl, double every_s) :
+      fname(fname), jsonl(jsonl), every_s(every_s), start(Clock::now()), last_write(start),
+      block_start(start), epoch_start(start) {}
+
+  // a block of sentences between two status lines, with its log loss and
+  // number of correctly predicted transitions
+  void end_block(unsigned long block_sentences, unsigned long block_transitions, double llh, double right) {
+    const double s = seconds(block_start);
+    sentences += block_sentences;
+    transitions += block_transitions;
+    sents_per_sec = s > 0 ? block_sentences / s : 0;
+    transitions_per_sec = s > 0 ? block_transitions / s : 0;
+    loss = block_transitions ? llh / block_transitions : 0;
+    err = block_transitions ? (block_transitions - right) / block_transitions : 0;
+    train_seconds += s;
+    block_start = Clock::now();
+  }
+
+  void new_epoch(bool first) {
+    if (!first) epoch_seconds = seconds(epoch_start);
+    epoch_start = Clock::now();
+  }
+
+  // a dev evaluation, which is not counted in the throughput of the next block
+  void add_dev(double uas, double dev_s) {
+    dev_uas.push_back(std::make_pair(iter, uas));
+    dev_seconds += dev_s;
+    block_start = Clock::now();
+  }
+
+  bool due() const { return seconds(last_write) >= every_s; }
+
+  void write() {
+    last_write = Clock::now();
+    const double elapsed = seconds(start);
+    const double eta = iter > start_iter && maxit > iter ? elapsed / (iter - start_iter) * (maxit - iter) : 0;
+    double best_uas = 0;
+    for (auto& d : dev_uas) best_uas = std::max(best_uas, d.second);
+    // only ever grow during a run (the _total suffix is for counters)
+    std::vector<std::pair<const char*, double>> counters = {
+        {"sentences_total", sentences}, {"transitions_total", transitions},
+        {"train_seconds_total", train_seconds}, {"dev_seconds_total", dev_seconds}};
+    std::vector<std::pair<const char*, double>> gauges = {
+        {"iterations", iter}, {"max_iterations", maxit}, {"epoch", epoch},
+        {"sentences_per_second", sents_per_sec}, {"transitions_per_second", transitions_per_sec},
+        {"epoch_seconds", epoch_seconds}, {"loss", loss}, {"error_rate", err},
+        {"dev_uas_best", best_uas}, {"elapsed_seconds", elapsed},
+        {"resident_bytes", resident_bytes()}, {"eta_seconds", eta}};
+    std::ostringstream out;
+    out << std::setprecision(10);
+    if (jsonl) {
+      out << "{\"time\": " << std::chrono::duration_cast<std::chrono::seconds>(
+                 std::chrono::system_clock::now().time_since_epoch()).count();
+      for (auto& c : counters) out << ", \"" << c.first << "\": " << c.second;
+      for (auto& g : gauges) out << ", \"" << g.first << "\": " << g.second;
+      out << ", \"dev_uas\": [";
+      for (unsigned i = 0; i < dev_uas.size(); ++i)
+        out << (i ? ", " : "") << "[" << dev_uas[i].first << ", " << dev_uas[i].second << "]";
+      out << "]}\n";
+      std::ofstream f(fname.c_str(), std::ios::app);
+      f << out.str();
+    } else {
+      for (auto& c : counters)
+        out << "# TYPE lstm_parser_" << c.first << " counter\nlstm_parser_" << c.first << ' ' << c.second << '\n';
+      for (auto& g : gauges)
+        out << "# TYPE lstm_parser_" << g.first << " gauge\nlstm_parser_" << g.first << ' ' << g.second << '\n';
+      out << "# TYPE lstm_parser_dev_uas gauge\n";
+      for (auto& d : dev_uas)
+        out << "lstm_parser_dev_uas{iter=\"" << d.first << "\"} " << d.second << '\n';
+      const std::string tmp = fname + ".tmp";
+      {
+        std::ofstream f(tmp.c_str());
+        f << out.str();
+      }
+      std::rename(tmp.c_str(), fname.c_str());
+    }
+  }
+
+  unsigned iter = 0;
+  unsigned start_iter = 0;  // when resuming from a checkpoint
+  unsigned maxit = 0;
+  double epoch = 0;
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  static double seconds(Clock::time_point since) {
+    return std::chrono::duration<double>(Clock::now() - since).count();
+  }
+
+  const std::string fname;
+  const bool jsonl;
+  const double every_s;
+  Clock::time_point start, last_write, block_start, epoch_start;
+  unsigned long sentences = 0;
+  unsigned long transitions = 0;
+  double sents_per_sec = 0;
+  double transitions_per_sec = 0;
+  double loss = 0;
+  double err = 0;
+  double epoch_seconds = 0;  // duration of the last complete epoch
+  double train_seconds = 0;
+  double dev_seconds = 0;
+  std::vector<std::pair<unsigned, double>> dev_uas;  // by iteration
+};
+
+#endif